@@ -0,0 +1,596 @@
+#include "automation_server.h"
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QRectF>
+#include <QScreen>
+#include <QSet>
+#include <QtConcurrent>
+
+namespace {
+
+// A single request line is capped so a client that never sends a newline cannot grow the buffer forever.
+const int MaxLineLength = 4 * 1024 * 1024;
+
+bool parseButton(const QJsonValue &value, Qt::MouseButton *button)
+{
+    if (value.isUndefined()) {
+        *button = Qt::LeftButton;
+        return true;
+    }
+
+    QString name = value.toString();
+    if (name == "left") {
+        *button = Qt::LeftButton;
+    } else if (name == "right") {
+        *button = Qt::RightButton;
+    } else if (name == "middle") {
+        *button = Qt::MiddleButton;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+}
+
+AutomationServer::AutomationServer(MouseController *mouseController, QObject *parent)
+    : QObject(parent),
+    mouseController(mouseController),
+    regionWaiter(nullptr),
+    server(new QLocalServer(this)),
+    dispatchTimer(new QTimer(this)),
+    injectedEvents(0),
+    completedBatches(0)
+{
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+    connect(server, &QLocalServer::newConnection, this, &AutomationServer::onNewConnection);
+
+    dispatchTimer->setSingleShot(true);
+    dispatchTimer->setTimerType(Qt::PreciseTimer);
+    connect(dispatchTimer, &QTimer::timeout, this, &AutomationServer::processQueue);
+}
+
+AutomationServer::~AutomationServer()
+{
+    stop();
+}
+
+QString AutomationServer::defaultServerName()
+{
+    return QStringLiteral("MultiDisplayHelper.control");
+}
+
+void AutomationServer::setRegionWaiter(RegionWaiter *waiter)
+{
+    if (regionWaiter) {
+        disconnect(regionWaiter, nullptr, this, nullptr);
+    }
+
+    regionWaiter = waiter;
+    if (regionWaiter) {
+        connect(regionWaiter, &RegionWaiter::waitFinished, this, &AutomationServer::onWaitFinished);
+    }
+}
+
+void AutomationServer::setScreenCapturer(ScreenCapturer *capturer)
+{
+    if (screenCapturer) {
+        disconnect(screenCapturer, nullptr, this, nullptr);
+    }
+
+    screenCapturer = capturer;
+    latestFrame = CapturedFrame();
+    if (screenCapturer) {
+        connect(screenCapturer, &ScreenCapturer::frameCaptured, this, &AutomationServer::onFrameCaptured);
+    }
+}
+
+bool AutomationServer::start(const QString &name)
+{
+    if (server->isListening()) return true;
+
+    // A previous instance that crashed leaves its socket file behind on Unix.
+    QLocalServer::removeServer(name);
+
+    if (!server->listen(name)) {
+        qDebug() << "Failed to open control socket" << name << ":" << server->errorString();
+        return false;
+    }
+
+    clock.start();
+    qDebug() << "Control socket listening on" << server->fullServerName();
+    return true;
+}
+
+void AutomationServer::stop()
+{
+    if (!server->isListening()) return;
+
+    dispatchTimer->stop();
+    queue.clear();
+    pendingInput.clear();
+    cancelWaits(nullptr);
+
+    const QList<QLocalSocket *> clients = findChildren<QLocalSocket *>();
+    for (QLocalSocket *client : clients) {
+        client->disconnect(this);
+        client->abort();
+        client->deleteLater();
+    }
+
+    server->close();
+    latestFrame = CapturedFrame();
+    qDebug() << "Control socket closed after" << completedBatches << "batches," << injectedEvents << "events";
+}
+
+bool AutomationServer::isListening() const
+{
+    return server->isListening();
+}
+
+QString AutomationServer::serverName() const
+{
+    return server->fullServerName();
+}
+
+void AutomationServer::onNewConnection()
+{
+    while (QLocalSocket *client = server->nextPendingConnection()) {
+        client->setParent(this);
+        connect(client, &QLocalSocket::readyRead, this, &AutomationServer::onClientReadyRead);
+        connect(client, &QLocalSocket::disconnected, this, &AutomationServer::onClientDisconnected);
+    }
+}
+
+void AutomationServer::onClientReadyRead()
+{
+    QLocalSocket *client = qobject_cast<QLocalSocket *>(sender());
+    if (!client) return;
+
+    // Taken out of the map while parsing: a reply that fails can disconnect the client, and the
+    // disconnect handler drops its entry.
+    QPointer<QLocalSocket> guard(client);
+    QByteArray buffer = pendingInput.take(client);
+    buffer += client->readAll();
+
+    int start = 0;
+    int end;
+    while ((end = buffer.indexOf('\n', start)) >= 0) {
+        QByteArray line = buffer.mid(start, end - start).trimmed();
+        start = end + 1;
+        if (!line.isEmpty()) {
+            handleRequest(client, line);
+            if (!guard || client->state() != QLocalSocket::ConnectedState) {
+                processQueue();
+                return;
+            }
+        }
+    }
+    buffer.remove(0, start);
+
+    if (buffer.size() > MaxLineLength) {
+        qDebug() << "Control client sent an oversized request, disconnecting";
+        sendError(client, QJsonValue(), "request too large");
+        client->disconnectFromServer();
+    } else if (client->state() == QLocalSocket::ConnectedState) {
+        pendingInput.insert(client, buffer);
+    }
+
+    processQueue();
+}
+
+void AutomationServer::onClientDisconnected()
+{
+    QLocalSocket *client = qobject_cast<QLocalSocket *>(sender());
+    if (!client) return;
+
+    // Batches already queued still run to completion so no button is left held down.
+    pendingInput.remove(client);
+    cancelWaits(client);
+    client->deleteLater();
+}
+
+void AutomationServer::handleRequest(QLocalSocket *client, const QByteArray &line)
+{
+    qint64 receivedNs = clock.nsecsElapsed();
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(line, &parseError);
+    if (!document.isObject()) {
+        sendError(client, QJsonValue(), parseError.error != QJsonParseError::NoError
+                                            ? parseError.errorString()
+                                            : QStringLiteral("request must be an object"));
+        return;
+    }
+
+    QJsonObject request = document.object();
+    if (request.contains("wait")) {
+        handleWait(client, request);
+        return;
+    }
+    if (request.contains("find")) {
+        handleFind(client, request);
+        return;
+    }
+
+    Batch batch;
+    batch.client = client;
+    batch.owner = client;
+    batch.id = request.value("id");
+    batch.receivedNs = receivedNs;
+    batch.controller = mouseController;
+
+    if (request.contains("screen")) {
+        batch.screenIndex = request.value("screen").toInt(-1);
+        if (batch.screenIndex < 0 || batch.screenIndex >= QGuiApplication::screens().size()) {
+            sendError(client, batch.id, "invalid screen index");
+            return;
+        }
+        batch.controller = controllerForScreen(batch.screenIndex);
+    }
+
+    const QJsonArray events = request.value("events").toArray();
+    batch.events.reserve(events.size());
+    for (int i = 0; i < events.size(); ++i) {
+        InputEvent event;
+        QString error;
+        if (!parseEvent(events[i].toObject(), receivedNs, &event, &error)) {
+            sendError(client, batch.id, QString("event %1: %2").arg(i).arg(error));
+            return;
+        }
+        if (event.scheduled) {
+            batch.scheduledEvents++;
+        }
+        batch.events.append(event);
+    }
+
+    queue.append(batch);
+}
+
+void AutomationServer::handleWait(QLocalSocket *client, const QJsonObject &request)
+{
+    QJsonValue id = request.value("id");
+    if (!regionWaiter) {
+        sendError(client, id, "waiting is not available");
+        return;
+    }
+
+    const QJsonArray rect = request.value("rect").toArray();
+    if (rect.size() != 4) {
+        sendError(client, id, "'rect' must be [x, y, width, height]");
+        return;
+    }
+    // Scripts use logical coordinates, like input events and find replies; RegionWaiter
+    // watches captured pixels.
+    qreal ratio = !latestFrame.isNull() ? latestFrame.devicePixelRatio
+                  : screenCapturer ? screenCapturer->getDevicePixelRatio() : 1.0;
+    QRect region = QRectF(rect[0].toDouble() * ratio, rect[1].toDouble() * ratio,
+                          rect[2].toDouble() * ratio, rect[3].toDouble() * ratio).toAlignedRect();
+    int timeoutMs = request.value("timeoutMs").toInt(-1);
+
+    QString condition = request.value("wait").toString();
+    int waitId;
+    if (condition == "change") {
+        waitId = regionWaiter->waitForChange(region, timeoutMs);
+    } else if (condition == "settle") {
+        waitId = regionWaiter->waitForSettle(region, request.value("quietMs").toInt(200), timeoutMs);
+    } else {
+        sendError(client, id, QString("unknown wait condition '%1'").arg(condition));
+        return;
+    }
+
+    PendingWait pending;
+    pending.client = client;
+    pending.id = id;
+    pendingWaits.insert(waitId, pending);
+}
+
+void AutomationServer::cancelWaits(QLocalSocket *client)
+{
+    if (!regionWaiter) return;
+
+    const QList<int> waitIds = pendingWaits.keys();
+    for (int waitId : waitIds) {
+        if (!client || pendingWaits.value(waitId).client == client) {
+            regionWaiter->cancel(waitId);
+        }
+    }
+}
+
+void AutomationServer::onWaitFinished(int waitId, RegionWaiter::Result result, qint64 elapsedMs)
+{
+    auto it = pendingWaits.find(waitId);
+    if (it == pendingWaits.end()) return;
+
+    PendingWait pending = it.value();
+    pendingWaits.erase(it);
+    if (!pending.client) return;
+
+    QJsonObject reply;
+    reply["id"] = pending.id;
+    reply["ok"] = true;
+    reply["result"] = RegionWaiter::resultName(result);
+    reply["elapsedMs"] = elapsedMs;
+    sendReply(pending.client, reply);
+}
+
+void AutomationServer::onFrameCaptured(const CapturedFrame &frame)
+{
+    // Holding the newest frame is free: the pool only reuses a buffer two frames later.
+    if (server->isListening()) {
+        latestFrame = frame;
+    }
+}
+
+void AutomationServer::handleFind(QLocalSocket *client, const QJsonObject &request)
+{
+    QJsonValue id = request.value("id");
+    if (latestFrame.isNull()) {
+        sendError(client, id, "no captured frame yet");
+        return;
+    }
+
+    QJsonValue find = request.value("find");
+    const QJsonArray paths = find.isArray() ? find.toArray() : QJsonArray{find};
+    QStringList templatePaths;
+    for (const QJsonValue &path : paths) {
+        templatePaths.append(path.toString());
+    }
+
+    const double threshold = request.value("threshold").toDouble(-1.0);
+    const int maxMatches = request.value("maxMatches").toInt(-1);
+    const bool changedOnly = request.value("changedOnly").toBool();
+    const CapturedFrame frame = latestFrame;
+
+    // Loading the templates and the search run on the thread pool so capture and input keep going.
+    auto *watcher = new QFutureWatcher<FindResult>(this);
+    QPointer<QLocalSocket> replyTo = client;
+    const quint64 sequence = frame.sequence;
+    connect(watcher, &QFutureWatcher<FindResult>::finished, this, [this, watcher, replyTo, id, sequence]() {
+        watcher->deleteLater();
+        if (replyTo) {
+            sendFindReply(replyTo, id, sequence, watcher->result());
+        }
+    });
+
+    watcher->setFuture(QtConcurrent::run([templatePaths, threshold, maxMatches, changedOnly, frame]() {
+        FindResult result;
+        ImageSearch search;
+        if (threshold >= 0) search.setThreshold(threshold);
+        if (maxMatches >= 0) search.setMaxMatches(maxMatches);
+        for (const QString &path : templatePaths) {
+            if (search.addTemplate(QImage(path)) < 0) {
+                result.error = QString("cannot load template '%1'").arg(path);
+                return result;
+            }
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        result.matches = search.find(frame, changedOnly);
+        result.searchNs = timer.nsecsElapsed();
+
+        // Replies use the logical coordinates that input events take.
+        for (ImageMatch &match : result.matches) {
+            match.rect = match.logicalRect(frame.devicePixelRatio);
+        }
+        return result;
+    }));
+}
+
+void AutomationServer::sendFindReply(QLocalSocket *client, const QJsonValue &id, quint64 frameSequence,
+                                     const FindResult &found)
+{
+    if (!found.error.isEmpty()) {
+        sendError(client, id, found.error);
+        return;
+    }
+
+    QJsonArray results;
+    for (const ImageMatch &match : found.matches) {
+        QJsonObject result;
+        result["template"] = match.templateIndex;
+        result["x"] = match.rect.x();
+        result["y"] = match.rect.y();
+        result["width"] = match.rect.width();
+        result["height"] = match.rect.height();
+        result["centerX"] = match.center().x();
+        result["centerY"] = match.center().y();
+        result["score"] = match.score;
+        results.append(result);
+    }
+
+    QJsonObject reply;
+    reply["id"] = id;
+    reply["ok"] = true;
+    reply["frame"] = QJsonValue(qint64(frameSequence));
+    reply["matches"] = results;
+    reply["searchMs"] = found.searchNs / 1e6;
+    sendReply(client, reply);
+}
+
+bool AutomationServer::parseEvent(const QJsonObject &object, qint64 receivedNs, InputEvent *event, QString *error) const
+{
+    QString type = object.value("type").toString();
+    if (type == "move") {
+        event->type = InputEvent::Move;
+    } else if (type == "press") {
+        event->type = InputEvent::Press;
+    } else if (type == "release") {
+        event->type = InputEvent::Release;
+    } else if (type == "click") {
+        event->type = InputEvent::Click;
+    } else if (type == "wheel") {
+        event->type = InputEvent::Wheel;
+    } else {
+        *error = QString("unknown event type '%1'").arg(type);
+        return false;
+    }
+
+    if (!object.value("x").isDouble() || !object.value("y").isDouble()) {
+        *error = "missing x/y";
+        return false;
+    }
+    event->position = QPoint(object.value("x").toInt(), object.value("y").toInt());
+
+    if (!parseButton(object.value("button"), &event->button)) {
+        *error = QString("unknown button '%1'").arg(object.value("button").toString());
+        return false;
+    }
+
+    event->delta = object.value("delta").toInt();
+
+    // "at" is a microsecond offset from when the batch was received.
+    if (object.contains("at")) {
+        double atUs = object.value("at").toDouble(-1.0);
+        if (atUs < 0) {
+            *error = "invalid 'at' offset";
+            return false;
+        }
+        event->scheduled = true;
+        event->dueNs = receivedNs + qint64(atUs * 1000.0);
+    }
+
+    return true;
+}
+
+MouseController *AutomationServer::controllerForScreen(int screenIndex)
+{
+    // Batches for a given screen get their own controller, so the screen picked in the window stays as it is.
+    MouseController *&controller = screenControllers[screenIndex];
+    if (!controller) {
+        controller = new MouseController(this);
+    }
+    return controller;
+}
+
+void AutomationServer::processQueue()
+{
+    dispatchTimer->stop();
+
+    while (true) {
+        // Batches run side by side, each in its own time; only one client's batches keep their order.
+        qint64 nextDueNs = -1;
+        QSet<const void *> busyOwners;
+        for (int i = 0; i < queue.size();) {
+            Batch &batch = queue[i];
+            if (busyOwners.contains(batch.owner)) {
+                ++i;
+                continue;
+            }
+
+            if (runBatch(batch, &nextDueNs)) {
+                queue.removeAt(i);
+            } else {
+                busyOwners.insert(batch.owner);
+                ++i;
+            }
+        }
+
+        if (nextDueNs < 0) return;
+
+        // Rounded up, so the timer never fires early; this runs on the GUI thread and must not spin.
+        qint64 waitNs = nextDueNs - clock.nsecsElapsed();
+        if (waitNs > 0) {
+            dispatchTimer->start(int((waitNs + 999999) / 1000000));
+            return;
+        }
+    }
+}
+
+bool AutomationServer::runBatch(Batch &batch, qint64 *nextDueNs)
+{
+    if (batch.nextEvent == 0 && batch.screenIndex >= 0) {
+        // The screen may have gone away since the batch was accepted.
+        if (!batch.controller->initialize(batch.screenIndex)) {
+            if (batch.client) {
+                sendError(batch.client, batch.id, "invalid screen index");
+            }
+            return true;
+        }
+        batch.screenIndex = -1;
+    }
+
+    while (batch.nextEvent < batch.events.size()) {
+        const InputEvent &event = batch.events[batch.nextEvent];
+
+        qint64 lateNs = 0;
+        if (event.scheduled) {
+            lateNs = clock.nsecsElapsed() - event.dueNs;
+            if (lateNs < 0) {
+                *nextDueNs = *nextDueNs < 0 ? event.dueNs : qMin(*nextDueNs, event.dueNs);
+                return false;
+            }
+        }
+
+        dispatch(batch.controller, event);
+        batch.nextEvent++;
+
+        if (event.scheduled) {
+            batch.jitterSumNs += lateNs;
+            batch.jitterMaxNs = qMax(batch.jitterMaxNs, lateNs);
+        }
+    }
+
+    finishBatch(batch);
+    return true;
+}
+
+void AutomationServer::dispatch(MouseController *controller, const InputEvent &event)
+{
+    switch (event.type) {
+    case InputEvent::Move:
+        controller->sendMouseMove(event.position);
+        break;
+    case InputEvent::Press:
+        controller->sendMousePress(event.position, event.button);
+        break;
+    case InputEvent::Release:
+        controller->sendMouseRelease(event.position, event.button);
+        break;
+    case InputEvent::Click:
+        controller->sendMouseClick(event.position, event.button);
+        break;
+    case InputEvent::Wheel:
+        controller->sendMouseWheel(event.position, event.delta);
+        break;
+    }
+}
+
+void AutomationServer::finishBatch(Batch &batch)
+{
+    injectedEvents += batch.events.size();
+    completedBatches++;
+
+    if (!batch.client) return;
+
+    QJsonObject reply;
+    reply["id"] = batch.id;
+    reply["ok"] = true;
+    reply["events"] = batch.events.size();
+    reply["scheduled"] = batch.scheduledEvents;
+    reply["jitterAvgUs"] = batch.scheduledEvents > 0 ? batch.jitterSumNs / 1000.0 / batch.scheduledEvents : 0.0;
+    reply["jitterMaxUs"] = batch.jitterMaxNs / 1000.0;
+    reply["elapsedUs"] = (clock.nsecsElapsed() - batch.receivedNs) / 1000.0;
+    sendReply(batch.client, reply);
+}
+
+void AutomationServer::sendReply(QLocalSocket *client, const QJsonObject &reply)
+{
+    if (client->state() != QLocalSocket::ConnectedState) return;
+
+    client->write(QJsonDocument(reply).toJson(QJsonDocument::Compact));
+    client->write("\n");
+}
+
+void AutomationServer::sendError(QLocalSocket *client, const QJsonValue &id, const QString &error)
+{
+    QJsonObject reply;
+    reply["id"] = id.isUndefined() ? QJsonValue() : id;
+    reply["ok"] = false;
+    reply["error"] = error;
+    sendReply(client, reply);
+}
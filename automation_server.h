@@ -0,0 +1,123 @@
+#ifndef AUTOMATION_SERVER_H
+#define AUTOMATION_SERVER_H
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QPointer>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#include "mouse_controller.h"
+#include "region_waiter.h"
+#include "image_search.h"
+
+class AutomationServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit AutomationServer(MouseController *mouseController, QObject *parent = nullptr);
+    ~AutomationServer();
+
+    static QString defaultServerName();
+
+    void setRegionWaiter(RegionWaiter *waiter);
+    void setScreenCapturer(ScreenCapturer *capturer);
+
+    bool start(const QString &name = defaultServerName());
+    void stop();
+    bool isListening() const;
+    QString serverName() const;
+
+private slots:
+    void onNewConnection();
+    void onClientReadyRead();
+    void onClientDisconnected();
+    void processQueue();
+    void onWaitFinished(int waitId, RegionWaiter::Result result, qint64 elapsedMs);
+    void onFrameCaptured(const CapturedFrame &frame);
+
+private:
+    struct InputEvent
+    {
+        enum Type {
+            Move,
+            Press,
+            Release,
+            Click,
+            Wheel
+        };
+
+        Type type = Move;
+        QPoint position;
+        Qt::MouseButton button = Qt::LeftButton;
+        int delta = 0;
+        bool scheduled = false;
+        qint64 dueNs = 0;
+    };
+
+    struct Batch
+    {
+        QPointer<QLocalSocket> client;
+        const void *owner = nullptr; // keeps one client's batches in order after it disconnects
+        QJsonValue id;
+        int screenIndex = -1;
+        MouseController *controller = nullptr;
+        QVector<InputEvent> events;
+        int nextEvent = 0;
+        int scheduledEvents = 0;
+        qint64 jitterSumNs = 0;
+        qint64 jitterMaxNs = 0;
+        qint64 receivedNs = 0;
+    };
+
+    struct PendingWait
+    {
+        QPointer<QLocalSocket> client;
+        QJsonValue id;
+    };
+
+    struct FindResult
+    {
+        QVector<ImageMatch> matches;
+        QString error;
+        qint64 searchNs = 0;
+    };
+
+    void handleRequest(QLocalSocket *client, const QByteArray &line);
+    void handleWait(QLocalSocket *client, const QJsonObject &request);
+    void cancelWaits(QLocalSocket *client);
+    void handleFind(QLocalSocket *client, const QJsonObject &request);
+    void sendFindReply(QLocalSocket *client, const QJsonValue &id, quint64 frameSequence,
+                       const FindResult &found);
+    bool parseEvent(const QJsonObject &object, qint64 receivedNs, InputEvent *event, QString *error) const;
+    MouseController *controllerForScreen(int screenIndex);
+    bool runBatch(Batch &batch, qint64 *nextDueNs);
+    void finishBatch(Batch &batch);
+    void dispatch(MouseController *controller, const InputEvent &event);
+    void sendReply(QLocalSocket *client, const QJsonObject &reply);
+    void sendError(QLocalSocket *client, const QJsonValue &id, const QString &error);
+
+    MouseController *mouseController;
+    QHash<int, MouseController *> screenControllers;
+    QPointer<RegionWaiter> regionWaiter;
+    QPointer<ScreenCapturer> screenCapturer;
+    CapturedFrame latestFrame;
+    QLocalServer *server;
+    QTimer *dispatchTimer;
+    QElapsedTimer clock;
+    QList<Batch> queue;
+    QHash<QLocalSocket *, QByteArray> pendingInput;
+    QHash<int, PendingWait> pendingWaits;
+
+    quint64 injectedEvents;
+    quint64 completedBatches;
+};
+
+#endif
@@ -0,0 +1,14 @@
+#ifndef CAPTURE_REGION_H
+#define CAPTURE_REGION_H
+
+#include <QRect>
+#include <QVector>
+
+// Part of the screen, in captured image pixels, that is grabbed at its own rate.
+struct CaptureRegion
+{
+    QRect rect;
+    int fps = 60;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef CAPTURED_FRAME_H
+#define CAPTURED_FRAME_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QMetaType>
+
+#include <chrono>
+
+struct CapturedFrame
+{
+    QImage image;
+    quint64 sequence = 0;
+    qint64 timestampNs = 0;
+    QRect screenGeometry;
+    qreal devicePixelRatio = 1.0; // captured pixels per logical screen pixel
+    // Where the image's top-left lies on the screen, in captured pixels. Non-zero after a crop;
+    // dirty rectangles are relative to the image.
+    QPoint origin;
+    QVector<QRect> dirtyRects;
+
+    bool isNull() const { return image.isNull(); }
+
+    static qint64 currentTimestampNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+Q_DECLARE_METATYPE(CapturedFrame)
+
+#endif
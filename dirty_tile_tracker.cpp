@@ -0,0 +1,170 @@
+#include "dirty_tile_tracker.h"
+
+#include <cstring>
+
+namespace {
+
+constexpr quint64 Prime1 = 0x9E3779B185EBCA87ULL;
+constexpr quint64 Prime2 = 0xC2B2AE3D27D4EB4FULL;
+
+inline quint64 loadWord(const uchar *data)
+{
+    quint64 value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+inline quint64 hashRound(quint64 acc, quint64 input)
+{
+    acc += input * Prime2;
+    acc = (acc << 31) | (acc >> 33);
+    return acc * Prime1;
+}
+
+}
+
+DirtyTileTracker::DirtyTileTracker()
+    : trackedFormat(QImage::Format_Invalid),
+    tileColumns(0),
+    tileRows(0),
+    changedCount(0)
+{
+}
+
+void DirtyTileTracker::reset()
+{
+    trackedSize = QSize();
+    trackedFormat = QImage::Format_Invalid;
+    tileColumns = 0;
+    tileRows = 0;
+    hashes.clear();
+    changed.clear();
+    changedCount = 0;
+}
+
+QRect DirtyTileTracker::tileRect(int column, int row) const
+{
+    QRect rect(column * TileSize, row * TileSize, TileSize, TileSize);
+    return rect.intersected(QRect(QPoint(0, 0), trackedSize));
+}
+
+QVector<QRect> DirtyTileTracker::update(const QImage &image)
+{
+    if (image.isNull()) {
+        reset();
+        return QVector<QRect>();
+    }
+
+    bool fullRefresh = image.size() != trackedSize || image.format() != trackedFormat;
+    if (fullRefresh) {
+        trackedSize = image.size();
+        trackedFormat = image.format();
+        tileColumns = (trackedSize.width() + TileSize - 1) / TileSize;
+        tileRows = (trackedSize.height() + TileSize - 1) / TileSize;
+        hashes.fill(0, tileColumns * tileRows);
+        changed.fill(false, tileColumns * tileRows);
+    }
+
+    changedCount = 0;
+    for (int row = 0; row < tileRows; ++row) {
+        for (int column = 0; column < tileColumns; ++column) {
+            int index = row * tileColumns + column;
+            quint64 hash = hashTile(image, tileRect(column, row));
+            bool tileChanged = fullRefresh || hash != hashes[index];
+            hashes[index] = hash;
+            changed.setBit(index, tileChanged);
+            if (tileChanged) {
+                changedCount++;
+            }
+        }
+    }
+
+    if (fullRefresh) {
+        return QVector<QRect>() << QRect(QPoint(0, 0), trackedSize);
+    }
+
+    return collectDirtyRects();
+}
+
+quint64 DirtyTileTracker::hashTile(const QImage &image, const QRect &rect)
+{
+    const int bytesPerPixel = image.depth() / 8;
+    const int rowBytes = rect.width() * bytesPerPixel;
+    const int xOffset = rect.x() * bytesPerPixel;
+
+    quint64 lane0 = Prime1 + Prime2;
+    quint64 lane1 = Prime2;
+    quint64 lane2 = 0;
+    quint64 lane3 = 0 - Prime1;
+    quint64 tail = rect.width() ^ (quint64(rect.height()) << 32);
+
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar *line = image.constScanLine(y) + xOffset;
+        int offset = 0;
+
+        for (; offset + 32 <= rowBytes; offset += 32) {
+            lane0 = hashRound(lane0, loadWord(line + offset));
+            lane1 = hashRound(lane1, loadWord(line + offset + 8));
+            lane2 = hashRound(lane2, loadWord(line + offset + 16));
+            lane3 = hashRound(lane3, loadWord(line + offset + 24));
+        }
+        for (; offset + 8 <= rowBytes; offset += 8) {
+            tail = hashRound(tail, loadWord(line + offset));
+        }
+        for (; offset < rowBytes; ++offset) {
+            tail = hashRound(tail, line[offset]);
+        }
+    }
+
+    quint64 hash = ((lane0 << 1) | (lane0 >> 63)) + ((lane1 << 7) | (lane1 >> 57))
+                   + ((lane2 << 12) | (lane2 >> 52)) + ((lane3 << 18) | (lane3 >> 46));
+    hash = hashRound(hash, tail);
+    hash ^= hash >> 33;
+    return hash;
+}
+
+QVector<QRect> DirtyTileTracker::collectDirtyRects() const
+{
+    QVector<QRect> rects;
+    QVector<int> openRects;
+
+    for (int row = 0; row < tileRows; ++row) {
+        QVector<int> rowRects;
+        int column = 0;
+
+        while (column < tileColumns) {
+            if (!changed.testBit(row * tileColumns + column)) {
+                ++column;
+                continue;
+            }
+
+            int start = column;
+            while (column < tileColumns && changed.testBit(row * tileColumns + column)) {
+                ++column;
+            }
+
+            QRect run = tileRect(start, row).united(tileRect(column - 1, row));
+
+            bool merged = false;
+            for (int index : openRects) {
+                QRect &above = rects[index];
+                if (above.left() == run.left() && above.right() == run.right()
+                    && above.bottom() + 1 == run.top()) {
+                    above.setBottom(run.bottom());
+                    rowRects.append(index);
+                    merged = true;
+                    break;
+                }
+            }
+
+            if (!merged) {
+                rowRects.append(rects.size());
+                rects.append(run);
+            }
+        }
+
+        openRects = rowRects;
+    }
+
+    return rects;
+}
@@ -0,0 +1,40 @@
+#ifndef DIRTY_TILE_TRACKER_H
+#define DIRTY_TILE_TRACKER_H
+
+#include <QImage>
+#include <QRect>
+#include <QVector>
+#include <QBitArray>
+
+class DirtyTileTracker
+{
+public:
+    static constexpr int TileSize = 64;
+
+    DirtyTileTracker();
+
+    QVector<QRect> update(const QImage &image);
+    void reset();
+
+    int columns() const { return tileColumns; }
+    int rows() const { return tileRows; }
+    QRect tileRect(int column, int row) const;
+
+    const QVector<quint64> &tileHashes() const { return hashes; }
+    const QBitArray &changedTiles() const { return changed; }
+    int changedTileCount() const { return changedCount; }
+
+private:
+    static quint64 hashTile(const QImage &image, const QRect &rect);
+    QVector<QRect> collectDirtyRects() const;
+
+    QSize trackedSize;
+    QImage::Format trackedFormat;
+    int tileColumns;
+    int tileRows;
+    QVector<quint64> hashes;
+    QBitArray changed;
+    int changedCount;
+};
+
+#endif
@@ -0,0 +1,190 @@
+#include "frame_history.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+static void fill(QImage &image, const QRect &rect, QRgb color, int noise, std::mt19937 &random)
+{
+    std::uniform_int_distribution<int> offset(-noise, noise);
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = rect.left(); x <= rect.right(); ++x) {
+            line[x] = noise ? qRgb(qBound(0, qRed(color) + offset(random), 255),
+                                   qBound(0, qGreen(color) + offset(random), 255),
+                                   qBound(0, qBlue(color) + offset(random), 255))
+                            : color;
+        }
+    }
+}
+
+// Flat panels on a plain background, roughly what a desktop looks like between redraws.
+static QImage makeDesktop(int width, int height, std::mt19937 &random)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    image.fill(qRgb(48, 56, 64));
+
+    std::uniform_int_distribution<int> channel(0, 255);
+    std::uniform_int_distribution<int> px(0, width - 400);
+    std::uniform_int_distribution<int> py(0, height - 200);
+    for (int i = 0; i < 300; ++i) {
+        QRgb color = qRgb(channel(random), channel(random), channel(random));
+        fill(image, QRect(px(random), py(random), 40 + i % 360, 12 + i % 180), color, i % 5 == 0 ? 3 : 0, random);
+    }
+    return image;
+}
+
+static size_t pixelHash(const QImage &image)
+{
+    size_t hash = 0;
+    for (int y = 0; y < image.height(); ++y) {
+        hash = qHashBits(image.constScanLine(y), size_t(image.width()) * 4, hash);
+    }
+    return hash;
+}
+
+struct Timing
+{
+    qint64 totalNs = 0;
+    qint64 maxNs = 0;
+    int count = 0;
+
+    void add(qint64 ns)
+    {
+        totalNs += ns;
+        maxNs = qMax(maxNs, ns);
+        ++count;
+    }
+
+    void print(const char *name) const
+    {
+        std::printf("%-22s %10.2f %10.2f\n", name, count ? totalNs / 1e6 / count : 0.0, maxNs / 1e6);
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times the rewind history on synthetic 4K capture: a busy panel, "
+                                     "a moving cursor and a large window redrawn every few seconds.");
+    parser.addHelpOption();
+
+    QCommandLineOption secondsOption("seconds", "Capture length to record.", "seconds", "60");
+    QCommandLineOption fpsOption("fps", "Capture rate.", "fps", "60");
+    QCommandLineOption threadsOption("threads", "Worker threads (0 = all cores).", "count", "0");
+    QCommandLineOption widthOption("width", "Frame width.", "pixels", "3840");
+    QCommandLineOption heightOption("height", "Frame height.", "pixels", "2160");
+    QCommandLineOption jumpsOption("jumps", "Random jumps to time.", "count", "50");
+    parser.addOption(secondsOption);
+    parser.addOption(fpsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(widthOption);
+    parser.addOption(heightOption);
+    parser.addOption(jumpsOption);
+    parser.process(app);
+
+    const int fps = qBound(1, parser.value(fpsOption).toInt(), 240);
+    const int frames = qMax(1, parser.value(secondsOption).toInt()) * fps;
+    const int threads = parser.value(threadsOption).toInt();
+    const int width = qMax(1280, parser.value(widthOption).toInt());
+    const int height = qMax(800, parser.value(heightOption).toInt());
+    const int jumps = qMax(1, parser.value(jumpsOption).toInt());
+    if (threads > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    }
+
+    std::mt19937 random(1234);
+    QImage frame = makeDesktop(width, height, random);
+
+    FrameHistory history;
+    history.setDuration(frames / fps + 1);
+
+    // A hash of every 50th frame to check the reconstructions against.
+    QVector<size_t> references;
+    QVector<quint64> referenceSequences;
+
+    const QRect panel(width - 840, 100, 800, 600);
+    const QRect window(width / 8, height / 5, width * 5 / 12, height * 15 / 32);
+    Timing append;
+    for (int i = 0; i < frames; ++i) {
+        CapturedFrame captured;
+        captured.sequence = i + 1;
+        captured.timestampNs = qint64(i) * 1000000000 / fps;
+
+        // Text-like updates inside the panel, a cursor, and a window redrawn every five seconds.
+        QRect text(panel.x() + (i * 7) % (panel.width() - 100), panel.y() + (i * 13) % (panel.height() - 40), 100, 40);
+        fill(frame, text, qRgb(random() % 256, random() % 256, random() % 256), 20, random);
+        captured.dirtyRects.append(panel);
+
+        QRect cursor((i * 11) % (width - 32), (i * 5) % (height - 32), 32, 32);
+        fill(frame, cursor, qRgb(255, 255, 255), 0, random);
+        captured.dirtyRects.append(cursor);
+
+        if (i % (fps * 5) == fps * 5 / 2) {
+            fill(frame, window, qRgb(random() % 256, random() % 256, random() % 256), 8, random);
+            captured.dirtyRects.append(window);
+        }
+
+        captured.image = frame.copy();
+        history.append(captured);
+        append.add(history.lastAppendNs());
+
+        if (i % 50 == 0) {
+            references.append(pixelHash(captured.image));
+            referenceSequences.append(captured.sequence);
+        }
+    }
+
+    std::printf("Frame %dx%d, %d thread(s), %d frames kept in %.1f MB\n", width, height,
+                QThreadPool::globalInstance()->maxThreadCount(), history.frameCount(),
+                history.memoryUsage() / (1024.0 * 1024.0));
+    std::printf("%-22s %10s %10s\n", "", "avg ms", "max ms");
+    append.print("append");
+
+    Timing stepBack;
+    const int newest = history.frameCount() - 1;
+    for (int i = newest; i >= qMax(0, newest - 10 * fps); --i) {
+        history.frameAt(i);
+        stepBack.add(history.lastReconstructNs());
+    }
+    stepBack.print("step back (10 s)");
+
+    // The first pass decodes every tile it needs; the second finds some of them in the cache.
+    QVector<int> targets;
+    std::uniform_int_distribution<int> anyFrame(0, newest);
+    for (int i = 0; i < jumps; ++i) {
+        targets.append(anyFrame(random));
+    }
+    Timing coldJump;
+    Timing warmJump;
+    const qint64 cacheLimit = history.getDecodeCacheLimit();
+    history.setDecodeCacheLimit(0);
+    history.setDecodeCacheLimit(cacheLimit);
+    for (int target : targets) {
+        history.frameAt(target);
+        coldJump.add(history.lastReconstructNs());
+    }
+    for (int target : targets) {
+        history.frameAt(target);
+        warmJump.add(history.lastReconstructNs());
+    }
+    coldJump.print("random jump");
+    warmJump.print("random jump, repeated");
+
+    int exact = 0;
+    int checked = 0;
+    for (int i = 0; i < references.size(); ++i) {
+        int index = history.indexOf(referenceSequences[i]);
+        if (index < 0) continue;
+        ++checked;
+        exact += pixelHash(history.frameAt(index)) == references[i] ? 1 : 0;
+    }
+    std::printf("%d of %d reference frames reconstructed exactly\n", exact, checked);
+    return exact == checked ? 0 : 1;
+}
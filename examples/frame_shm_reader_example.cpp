@@ -0,0 +1,134 @@
+#include "frame_shm_reader.h"
+#include "captured_frame.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+struct ReaderStats
+{
+    quint64 frames = 0;
+    quint64 skipped = 0;
+    quint64 overwritten = 0;
+    quint64 bytes = 0;
+    qint64 totalLatencyNs = 0;
+    qint64 maxLatencyNs = 0;
+    quint64 checksum = 0;
+};
+
+static void runReader(const QString &key, int holdMs, const std::atomic<bool> &running, ReaderStats &stats)
+{
+    FrameShmReader reader(key);
+    quint64 lastSeen = 0;
+
+    while (running.load()) {
+        if (!reader.isAttached() || reader.isWriterClosed()) {
+            // Let go of a closed segment before waiting, so the writer can create it again.
+            lastSeen = 0;
+            if (reader.isAttached() || !reader.attach()) {
+                reader.detach();
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            continue;
+        }
+
+        if (reader.latestFrameNumber() == lastSeen) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        FrameShmReader::Frame frame = reader.latestFrame();
+        if (frame.isNull()) continue;
+
+        quint64 sum = 0;
+        const int rowBytes = frame.width * (frame.image().depth() / 8);
+        for (int y = 0; y < frame.height; ++y) {
+            const uchar *line = frame.bits + qint64(y) * frame.bytesPerLine;
+            for (int x = 0; x < rowBytes; x += 64) {
+                sum += line[x];
+            }
+        }
+
+        if (holdMs > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(holdMs));
+        }
+
+        if (!reader.isStillValid(frame)) {
+            stats.overwritten++;
+        } else {
+            qint64 latency = CapturedFrame::currentTimestampNs() - frame.timestampNs;
+            stats.frames++;
+            stats.bytes += quint64(rowBytes) * frame.height;
+            stats.totalLatencyNs += latency;
+            stats.maxLatencyNs = qMax(stats.maxLatencyNs, latency);
+            stats.checksum += sum;
+            if (lastSeen != 0 && frame.frameNumber > lastSeen + 1) {
+                stats.skipped += frame.frameNumber - lastSeen - 1;
+            }
+        }
+        lastSeen = frame.frameNumber;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Reads frames shared by MultiDisplayHelper and reports per-reader throughput.");
+    parser.addHelpOption();
+
+    QCommandLineOption keyOption("key", "Shared memory key.", "key", QString::fromLatin1(FrameShm::DefaultKey));
+    QCommandLineOption readersOption("readers", "Number of concurrent readers.", "count", "1");
+    QCommandLineOption secondsOption("seconds", "How long to read, in seconds.", "seconds", "10");
+    QCommandLineOption holdOption("hold-ms", "How long each reader holds a frame, to simulate slow consumers.", "ms", "0");
+    parser.addOption(keyOption);
+    parser.addOption(readersOption);
+    parser.addOption(secondsOption);
+    parser.addOption(holdOption);
+    parser.process(app);
+
+    const QString key = parser.value(keyOption);
+    const int readerCount = qMax(1, parser.value(readersOption).toInt());
+    const int seconds = qMax(1, parser.value(secondsOption).toInt());
+    const int holdMs = qMax(0, parser.value(holdOption).toInt());
+
+    std::printf("Reading '%s' with %d reader(s) for %d s, holding each frame %d ms\n",
+                qPrintable(key), readerCount, seconds, holdMs);
+
+    std::atomic<bool> running(true);
+    std::vector<ReaderStats> stats(readerCount);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < readerCount; ++i) {
+        threads.emplace_back(runReader, key, holdMs, std::cref(running), std::ref(stats[i]));
+    }
+
+    std::this_thread::sleep_for(std::chrono::seconds(seconds));
+    running.store(false);
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+
+    quint64 totalFrames = 0;
+    quint64 totalBytes = 0;
+    for (int i = 0; i < readerCount; ++i) {
+        const ReaderStats &s = stats[i];
+        double avgLatencyMs = s.frames ? s.totalLatencyNs / 1e6 / s.frames : 0.0;
+        std::printf("reader %2d: %6.1f fps  %8.1f MB/s  skipped %llu  overwritten %llu  latency avg %.2f ms max %.2f ms\n",
+                    i, double(s.frames) / seconds, s.bytes / 1e6 / seconds,
+                    static_cast<unsigned long long>(s.skipped),
+                    static_cast<unsigned long long>(s.overwritten),
+                    avgLatencyMs, s.maxLatencyNs / 1e6);
+        totalFrames += s.frames;
+        totalBytes += s.bytes;
+    }
+
+    std::printf("total:     %6.1f frames/s  %8.1f MB/s\n",
+                double(totalFrames) / seconds, totalBytes / 1e6 / seconds);
+    return 0;
+}
@@ -0,0 +1,150 @@
+#include "image_search.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QThreadPool>
+
+#include <algorithm>
+#include <cstdio>
+#include <random>
+
+// Flat panels with some noise, roughly what a desktop looks like to the matcher.
+static QImage makeDesktop(int width, int height, std::mt19937 &random)
+{
+    QImage image(width, height, QImage::Format_RGB32);
+    std::uniform_int_distribution<int> channel(0, 255);
+    std::uniform_int_distribution<int> noise(-6, 6);
+
+    for (int y = 0; y < height; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < width; ++x) {
+            int shade = 180 + ((x / 240 + y / 135) % 3) * 20 + noise(random);
+            line[x] = qRgb(shade, shade, qBound(0, shade + 10, 255));
+        }
+    }
+
+    std::uniform_int_distribution<int> px(0, width - 400);
+    std::uniform_int_distribution<int> py(0, height - 200);
+    for (int i = 0; i < 300; ++i) {
+        QRgb color = qRgb(channel(random), channel(random), channel(random));
+        int x0 = px(random);
+        int y0 = py(random);
+        for (int y = y0; y < y0 + 12 + i % 180; ++y) {
+            QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+            for (int x = x0; x < x0 + 40 + i % 360; ++x) {
+                line[x] = color;
+            }
+        }
+    }
+    return image;
+}
+
+// A glyph on a tinted tile with a little noise, similar in structure to toolbar icons.
+static QImage makeIcon(int size, std::mt19937 &random)
+{
+    QImage icon(size, size, QImage::Format_RGB32);
+    std::uniform_int_distribution<int> channel(0, 255);
+    std::uniform_int_distribution<int> noise(-12, 12);
+
+    const QRgb tile = qRgb(channel(random) / 2, channel(random) / 2, 160 + channel(random) / 4);
+    const QRgb glyph = qRgb(250, 250, 250);
+    const int radius = size / 3;
+    const int centre = size / 2;
+
+    for (int y = 0; y < size; ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(icon.scanLine(y));
+        for (int x = 0; x < size; ++x) {
+            int dx = x - centre;
+            int dy = y - centre;
+            bool ring = dx * dx + dy * dy <= radius * radius && dx * dx + dy * dy >= (radius / 2) * (radius / 2);
+            bool bar = x >= centre && y >= centre - size / 16 && y <= centre + size / 16;
+            QRgb color = ring || bar ? glyph : tile;
+            int n = noise(random);
+            line[x] = qRgb(qBound(0, qRed(color) + n, 255), qBound(0, qGreen(color) + n, 255),
+                           qBound(0, qBlue(color) + n, 255));
+        }
+    }
+    return icon;
+}
+
+static void paste(QImage &target, const QImage &source, const QPoint &position)
+{
+    for (int y = 0; y < source.height(); ++y) {
+        const QRgb *src = reinterpret_cast<const QRgb *>(source.constScanLine(y));
+        QRgb *dst = reinterpret_cast<QRgb *>(target.scanLine(position.y() + y)) + position.x();
+        std::copy(src, src + source.width(), dst);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times template matching on a synthetic 4K frame.");
+    parser.addHelpOption();
+
+    QCommandLineOption iterationsOption("iterations", "Searches per measurement.", "count", "20");
+    QCommandLineOption threadsOption("threads", "Worker threads (0 = all cores).", "count", "0");
+    QCommandLineOption widthOption("width", "Frame width.", "pixels", "3840");
+    QCommandLineOption heightOption("height", "Frame height.", "pixels", "2160");
+    parser.addOption(iterationsOption);
+    parser.addOption(threadsOption);
+    parser.addOption(widthOption);
+    parser.addOption(heightOption);
+    parser.process(app);
+
+    const int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    const int threads = parser.value(threadsOption).toInt();
+    const int width = qMax(640, parser.value(widthOption).toInt());
+    const int height = qMax(480, parser.value(heightOption).toInt());
+    if (threads > 0) {
+        QThreadPool::globalInstance()->setMaxThreadCount(threads);
+    }
+
+    std::mt19937 random(1234);
+    QImage frame = makeDesktop(width, height, random);
+
+    std::printf("Frame %dx%d, %d thread(s), %d iterations\n",
+                width, height, QThreadPool::globalInstance()->maxThreadCount(), iterations);
+    std::printf("%-8s %-12s %10s %10s %8s %s\n", "icon", "area", "avg ms", "min ms", "score", "found at");
+
+    const int sizes[] = {16, 24, 32, 48, 64};
+    for (int size : sizes) {
+        QImage icon = makeIcon(size, random);
+        QPoint position(width * 5 / 7 - size / 2 + size % 7, height / 3 + size);
+        paste(frame, icon, position);
+
+        ImageSearch search;
+        search.addTemplate(icon);
+
+        QRect changed(position - QPoint(100, 60), QSize(256, 160));
+        struct Run { const char *name; QRegion area; };
+        const Run runs[] = {{"full frame", QRegion(frame.rect())}, {"changed", QRegion(changed)}};
+
+        for (const Run &run : runs) {
+            QVector<ImageMatch> matches;
+            qint64 totalNs = 0;
+            qint64 minNs = -1;
+            for (int i = 0; i < iterations; ++i) {
+                QElapsedTimer timer;
+                timer.start();
+                matches = search.find(frame, run.area);
+                qint64 elapsed = timer.nsecsElapsed();
+                totalNs += elapsed;
+                minNs = minNs < 0 ? elapsed : qMin(minNs, elapsed);
+            }
+
+            QString where = matches.isEmpty() ? QString("not found")
+                                              : QString("%1,%2%3").arg(matches.first().rect.x())
+                                                                 .arg(matches.first().rect.y())
+                                                                 .arg(matches.first().rect.topLeft() == position
+                                                                          ? "" : " (wrong)");
+            std::printf("%2dx%-5d %-12s %10.2f %10.2f %8.3f %s\n", size, size, run.name,
+                        totalNs / 1e6 / iterations, minNs / 1e6,
+                        matches.isEmpty() ? 0.0 : matches.first().score, qPrintable(where));
+        }
+    }
+    return 0;
+}
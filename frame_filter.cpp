@@ -0,0 +1,120 @@
+#include "frame_filter.h"
+#include "simd_support.h"
+
+namespace FrameKernels {
+
+void fillPixels(quint32 *pixels, int count, quint32 value)
+{
+    int i = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i fill = _mm_set1_epi32(int(value));
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(pixels + i), fill);
+    }
+#endif
+    for (; i < count; ++i) {
+        pixels[i] = value;
+    }
+}
+
+void grayscalePixels(quint32 *pixels, int count)
+{
+    int i = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i alphaMask = _mm_set1_epi32(int(0xff000000));
+    const __m128i redWeight = _mm_set1_epi32(77);
+    const __m128i greenWeight = _mm_set1_epi32(150);
+    const __m128i blueWeight = _mm_set1_epi32(29);
+
+    for (; i + 4 <= count; i += 4) {
+        __m128i *chunk = reinterpret_cast<__m128i *>(pixels + i);
+        __m128i p = _mm_loadu_si128(chunk);
+
+        __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), byteMask);
+        __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), byteMask);
+        __m128i b = _mm_and_si128(p, byteMask);
+
+        __m128i sum = _mm_add_epi32(_mm_mullo_epi16(r, redWeight), _mm_mullo_epi16(g, greenWeight));
+        sum = _mm_add_epi32(sum, _mm_mullo_epi16(b, blueWeight));
+        __m128i gray = _mm_srli_epi32(sum, 8);
+
+        __m128i out = _mm_or_si128(gray, _mm_slli_epi32(gray, 8));
+        out = _mm_or_si128(out, _mm_slli_epi32(gray, 16));
+        out = _mm_or_si128(out, _mm_and_si128(p, alphaMask));
+        _mm_storeu_si128(chunk, out);
+    }
+#endif
+    for (; i < count; ++i) {
+        quint32 p = pixels[i];
+        quint32 gray = (((p >> 16) & 0xff) * 77 + ((p >> 8) & 0xff) * 150 + (p & 0xff) * 29) >> 8;
+        pixels[i] = (p & 0xff000000) | (gray << 16) | (gray << 8) | gray;
+    }
+}
+
+}
+
+MaskFilter::MaskFilter(const QVector<QRect> &maskRects, const QColor &color)
+    : maskRects(maskRects),
+    fillPixel(color.rgba())
+{
+}
+
+void MaskFilter::setMaskRects(const QVector<QRect> &rects)
+{
+    maskRects = rects;
+}
+
+QVector<QRect> MaskFilter::getMaskRects() const
+{
+    return maskRects;
+}
+
+void MaskFilter::apply(QImage &image, const QRect &rect)
+{
+    for (const QRect &mask : maskRects) {
+        QRect area = mask.intersected(rect).intersected(image.rect());
+        if (area.isEmpty()) continue;
+
+        for (int y = area.top(); y <= area.bottom(); ++y) {
+            quint32 *line = reinterpret_cast<quint32 *>(image.scanLine(y));
+            FrameKernels::fillPixels(line + area.x(), area.width(), fillPixel);
+        }
+    }
+}
+
+void GrayscaleFilter::apply(QImage &image, const QRect &rect)
+{
+    QRect area = rect.intersected(image.rect());
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        quint32 *line = reinterpret_cast<quint32 *>(image.scanLine(y));
+        FrameKernels::grayscalePixels(line + area.x(), area.width());
+    }
+}
+
+CropFilter::CropFilter(const QRect &cropRect)
+    : cropRect(cropRect)
+{
+}
+
+void CropFilter::setCropRect(const QRect &rect)
+{
+    cropRect = rect;
+}
+
+QRect CropFilter::getCropRect() const
+{
+    return cropRect;
+}
+
+void CropFilter::apply(QImage &image, const QRect &rect)
+{
+    // Nothing to do per pixel: the pipeline hands out a view of outputRect() without copying.
+    Q_UNUSED(image);
+    Q_UNUSED(rect);
+}
+
+QRect CropFilter::outputRect(const QRect &frameRect) const
+{
+    return frameRect.intersected(cropRect);
+}
@@ -0,0 +1,70 @@
+#ifndef FRAME_FILTER_H
+#define FRAME_FILTER_H
+
+#include <QImage>
+#include <QRect>
+#include <QColor>
+#include <QVector>
+#include <QString>
+
+// Filters work in place on 32-bit frames. All rectangles are in screen-local
+// pixel coordinates, including those handed to filters after a crop. The
+// cropped frame carries its offset in CapturedFrame::origin.
+class FrameFilter
+{
+public:
+    virtual ~FrameFilter() = default;
+
+    virtual QString name() const = 0;
+    virtual void apply(QImage &image, const QRect &rect) = 0;
+    virtual QRect outputRect(const QRect &frameRect) const { return frameRect; }
+};
+
+class MaskFilter : public FrameFilter
+{
+public:
+    explicit MaskFilter(const QVector<QRect> &maskRects = QVector<QRect>(),
+                        const QColor &color = Qt::black);
+
+    QString name() const override { return "Mask"; }
+    void apply(QImage &image, const QRect &rect) override;
+
+    void setMaskRects(const QVector<QRect> &rects);
+    QVector<QRect> getMaskRects() const;
+
+private:
+    QVector<QRect> maskRects;
+    quint32 fillPixel;
+};
+
+class GrayscaleFilter : public FrameFilter
+{
+public:
+    QString name() const override { return "Grayscale"; }
+    void apply(QImage &image, const QRect &rect) override;
+};
+
+class CropFilter : public FrameFilter
+{
+public:
+    explicit CropFilter(const QRect &cropRect);
+
+    QString name() const override { return "Crop"; }
+    void apply(QImage &image, const QRect &rect) override;
+    QRect outputRect(const QRect &frameRect) const override;
+
+    void setCropRect(const QRect &rect);
+    QRect getCropRect() const;
+
+private:
+    QRect cropRect;
+};
+
+namespace FrameKernels {
+
+void fillPixels(quint32 *pixels, int count, quint32 value);
+void grayscalePixels(quint32 *pixels, int count);
+
+}
+
+#endif
@@ -0,0 +1,244 @@
+#include "frame_filter_pipeline.h"
+
+#include <QElapsedTimer>
+
+namespace {
+
+void releaseBuffer(void *info)
+{
+    delete static_cast<QImage *>(info);
+}
+
+}
+
+FrameFilterPipeline::FrameFilterPipeline()
+    : invalidated(true),
+    unchangedFrameCount(0)
+{
+}
+
+FrameFilterPipeline::~FrameFilterPipeline()
+{
+    qDeleteAll(filterChain);
+}
+
+void FrameFilterPipeline::addFilter(FrameFilter *filter)
+{
+    if (!filter) return;
+
+    filterChain.append(filter);
+    FrameFilterStats stats;
+    stats.name = filter->name();
+    filterStats.append(stats);
+    invalidate();
+}
+
+void FrameFilterPipeline::removeFilter(FrameFilter *filter)
+{
+    int index = filterChain.indexOf(filter);
+    if (index < 0) return;
+
+    delete filterChain.takeAt(index);
+    filterStats.removeAt(index);
+    invalidate();
+}
+
+void FrameFilterPipeline::clearFilters()
+{
+    qDeleteAll(filterChain);
+    filterChain.clear();
+    filterStats.clear();
+    invalidate();
+}
+
+QVector<FrameFilter *> FrameFilterPipeline::filters() const
+{
+    return filterChain;
+}
+
+bool FrameFilterPipeline::isEmpty() const
+{
+    return filterChain.isEmpty();
+}
+
+void FrameFilterPipeline::invalidate()
+{
+    invalidated = true;
+    lastOutput = QImage();
+    pool.reset();
+}
+
+QVector<FrameFilterStats> FrameFilterPipeline::stats() const
+{
+    return filterStats;
+}
+
+quint64 FrameFilterPipeline::unchangedFrames() const
+{
+    return unchangedFrameCount;
+}
+
+void FrameFilterPipeline::resetStats()
+{
+    for (FrameFilterStats &stats : filterStats) {
+        stats.frames = 0;
+        stats.pixels = 0;
+        stats.totalNs = 0;
+        stats.lastNs = 0;
+    }
+    unchangedFrameCount = 0;
+    pool.resetStats();
+}
+
+quint64 FrameFilterPipeline::sharedBufferCopies() const
+{
+    return pool.sharedCopies();
+}
+
+QRect FrameFilterPipeline::outputRectFor(const QRect &frameRect) const
+{
+    QRect rect = frameRect;
+    for (const FrameFilter *filter : filterChain) {
+        rect = filter->outputRect(rect);
+    }
+    return rect;
+}
+
+QImage FrameFilterPipeline::viewOf(const QImage &buffer, const QRect &rect)
+{
+    const uchar *data = buffer.constBits() + qint64(rect.y()) * buffer.bytesPerLine()
+                        + rect.x() * (buffer.depth() / 8);
+    return QImage(data, rect.width(), rect.height(), buffer.bytesPerLine(), buffer.format(),
+                  releaseBuffer, new QImage(buffer));
+}
+
+bool FrameFilterPipeline::isFilterableFormat(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32
+           || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+bool FrameFilterPipeline::process(CapturedFrame &frame, const QRect &patchRect)
+{
+    if (patchRect.isNull()) return compose(frame, QVector<FramePatch>());
+    if (frame.image.isNull()) return false;
+
+    FramePatch patch;
+    patch.image = std::move(frame.image);
+    patch.origin = patchRect.topLeft();
+    return compose(frame, QVector<FramePatch>() << patch);
+}
+
+bool FrameFilterPipeline::process(CapturedFrame &frame, const QVector<FramePatch> &patches)
+{
+    if (patches.isEmpty()) return false;
+    return compose(frame, patches);
+}
+
+bool FrameFilterPipeline::compose(CapturedFrame &frame, QVector<FramePatch> patches)
+{
+    const bool fullPatch = patches.isEmpty();
+    if (fullPatch && frame.image.isNull()) return false;
+
+    if (fullPatch && !filterChain.isEmpty() && !isFilterableFormat(frame.image.format())) {
+        frame.image = frame.image.convertToFormat(QImage::Format_RGB32);
+    }
+
+    const bool fullRefresh = invalidated || !pool.isValid()
+                             || (fullPatch && (pool.size() != frame.image.size()
+                                               || pool.format() != frame.image.format()));
+
+    // A partial grab can only be composed onto an up-to-date frame.
+    if (fullRefresh && !fullPatch) return false;
+
+    QRegion patchArea;
+    for (FramePatch &patch : patches) {
+        if (patch.image.format() != pool.format()) {
+            patch.image = patch.image.convertToFormat(pool.format());
+        }
+        patchArea += QRect(patch.origin, patch.image.size());
+    }
+
+    const QRect frameRect = fullPatch ? frame.image.rect() : QRect(QPoint(0, 0), pool.size());
+    const QRect outputRect = outputRectFor(frameRect);
+    if (outputRect.isEmpty()) {
+        frame.image = QImage();
+        frame.dirtyRects.clear();
+        return true;
+    }
+
+    QRegion dirty;
+    if (fullRefresh) {
+        dirty = frameRect;
+    } else {
+        for (const QRect &rect : frame.dirtyRects) {
+            dirty += rect;
+        }
+        if (!fullPatch) {
+            dirty &= patchArea;
+        }
+    }
+
+    qint64 dirtyArea = 0;
+    for (const QRect &rect : dirty) {
+        dirtyArea += qint64(rect.width()) * rect.height();
+    }
+
+    QRegion visibleDirty = dirty.intersected(outputRect);
+    frame.origin = outputRect.topLeft();
+    if (!fullRefresh && visibleDirty.isEmpty()) {
+        frame.image = lastOutput;
+        frame.dirtyRects.clear();
+        unchangedFrameCount++;
+        return true;
+    }
+
+    QRegion processRegion;
+    QImage *buffer;
+    if (fullPatch && (fullRefresh || filterChain.isEmpty()
+                      || dirtyArea * 2 > qint64(frameRect.width()) * frameRect.height())) {
+        buffer = &pool.adopt(std::move(frame.image), dirty);
+        processRegion = outputRect;
+    } else {
+        if (fullPatch) {
+            patches.append(FramePatch{std::move(frame.image), QPoint(0, 0)});
+        }
+        buffer = &pool.beginFrame(dirty);
+        for (const FramePatch &patch : patches) {
+            for (const QRect &rect : dirty.intersected(QRect(patch.origin, patch.image.size()))) {
+                FramePool::copyRect(*buffer, patch.image, rect, patch.origin);
+            }
+        }
+        processRegion = visibleDirty;
+    }
+    invalidated = false;
+
+    qint64 processArea = 0;
+    for (const QRect &rect : processRegion) {
+        processArea += qint64(rect.width()) * rect.height();
+    }
+
+    QElapsedTimer timer;
+    for (int i = 0; i < filterChain.size(); ++i) {
+        timer.start();
+        for (const QRect &rect : processRegion) {
+            filterChain[i]->apply(*buffer, rect);
+        }
+
+        FrameFilterStats &stats = filterStats[i];
+        stats.lastNs = timer.nsecsElapsed();
+        stats.totalNs += stats.lastNs;
+        stats.pixels += quint64(processArea);
+        stats.frames++;
+    }
+
+    frame.image = outputRect == frameRect ? *buffer : viewOf(*buffer, outputRect);
+
+    frame.dirtyRects.clear();
+    for (const QRect &rect : fullRefresh ? QRegion(outputRect) : visibleDirty) {
+        frame.dirtyRects.append(rect.translated(-outputRect.topLeft()));
+    }
+
+    lastOutput = frame.image;
+    return true;
+}
@@ -0,0 +1,62 @@
+#ifndef FRAME_FILTER_PIPELINE_H
+#define FRAME_FILTER_PIPELINE_H
+
+#include <QVector>
+#include <QString>
+
+#include "captured_frame.h"
+#include "frame_filter.h"
+#include "frame_pool.h"
+
+struct FrameFilterStats
+{
+    QString name;
+    quint64 frames = 0;
+    quint64 pixels = 0;
+    qint64 totalNs = 0;
+    qint64 lastNs = 0;
+};
+
+// A grabbed piece of the screen and where it goes in the full frame.
+struct FramePatch
+{
+    QImage image;
+    QPoint origin;
+};
+
+class FrameFilterPipeline
+{
+public:
+    FrameFilterPipeline();
+    ~FrameFilterPipeline();
+
+    void addFilter(FrameFilter *filter);
+    void removeFilter(FrameFilter *filter);
+    void clearFilters();
+    QVector<FrameFilter *> filters() const;
+    bool isEmpty() const;
+
+    void invalidate();
+    bool process(CapturedFrame &frame, const QRect &patchRect = QRect());
+    bool process(CapturedFrame &frame, const QVector<FramePatch> &patches);
+
+    QVector<FrameFilterStats> stats() const;
+    quint64 unchangedFrames() const;
+    quint64 sharedBufferCopies() const;
+    void resetStats();
+
+private:
+    bool compose(CapturedFrame &frame, QVector<FramePatch> patches);
+    QRect outputRectFor(const QRect &frameRect) const;
+    static QImage viewOf(const QImage &buffer, const QRect &rect);
+    static bool isFilterableFormat(QImage::Format format);
+
+    QVector<FrameFilter *> filterChain;
+    QVector<FrameFilterStats> filterStats;
+    FramePool pool;
+    QImage lastOutput;
+    bool invalidated;
+    quint64 unchangedFrameCount;
+};
+
+#endif
@@ -0,0 +1,485 @@
+#include "frame_history.h"
+
+#include <QtConcurrent>
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include <QSet>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+// Bookkeeping charged against the memory limit besides the compressed tiles.
+constexpr qint64 EntryOverhead = sizeof(QByteArray) + sizeof(int);
+
+struct TileJob
+{
+    int tile;
+    QRect rect;
+    QByteArray data;
+    QByteArray raw; // decoded pixels, when already known
+};
+
+// Tiles are stored as their rows packed together; level 1 compresses desktop content well
+// and keeps appending cheap enough for the capture thread.
+void encodeTiles(QVector<TileJob> &jobs, const QImage &image, const QImage &previous)
+{
+    const uchar *bits = image.constBits();
+    const uchar *previousBits = previous.isNull() ? nullptr : previous.constBits();
+    const int stride = image.bytesPerLine();
+    const int previousStride = previous.bytesPerLine();
+    const int bytesPerPixel = image.depth() / 8;
+
+    QtConcurrent::blockingMap(jobs, [=](TileJob &job) {
+        const int offset = job.rect.x() * bytesPerPixel;
+        const int length = job.rect.width() * bytesPerPixel;
+
+        if (previousBits) {
+            bool same = true;
+            for (int y = job.rect.top(); y <= job.rect.bottom() && same; ++y) {
+                same = std::memcmp(bits + qint64(y) * stride + offset,
+                                   previousBits + qint64(y) * previousStride + offset, length) == 0;
+            }
+            if (same) return;
+        }
+
+        QByteArray raw(length * job.rect.height(), Qt::Uninitialized);
+        char *dst = raw.data();
+        for (int y = job.rect.top(); y <= job.rect.bottom(); ++y) {
+            std::memcpy(dst, bits + qint64(y) * stride + offset, length);
+            dst += length;
+        }
+        job.data = qCompress(raw, 1);
+    });
+}
+
+void decodeTiles(QVector<TileJob> &jobs, QImage &target)
+{
+    uchar *bits = target.bits();
+    const int stride = target.bytesPerLine();
+    const int bytesPerPixel = target.depth() / 8;
+
+    QtConcurrent::blockingMap(jobs, [=](TileJob &job) {
+        const int offset = job.rect.x() * bytesPerPixel;
+        const int length = job.rect.width() * bytesPerPixel;
+
+        if (job.raw.isEmpty()) {
+            job.raw = qUncompress(job.data);
+        }
+        if (job.raw.size() != length * job.rect.height()) return;
+
+        const char *src = job.raw.constData();
+        for (int y = job.rect.top(); y <= job.rect.bottom(); ++y) {
+            std::memcpy(bits + qint64(y) * stride + offset, src, length);
+            src += length;
+        }
+    });
+}
+
+}
+
+FrameHistory::FrameHistory()
+    : durationSeconds(60),
+    memoryLimit(384LL * 1024 * 1024),
+    keyframeIntervalMs(1000),
+    frameFormat(QImage::Format_Invalid),
+    tileColumns(0),
+    tileRows(0),
+    firstFrameId(0),
+    generation(0),
+    usedBytes(0),
+    groupBytes(0),
+    keyframeTimestampNs(0),
+    lastReconstruction(0),
+    decodedTiles(64 * 1024 * 1024),
+    appendNs(0),
+    reconstructNs(0)
+{
+}
+
+void FrameHistory::setDuration(int seconds)
+{
+    QMutexLocker locker(&mutex);
+    durationSeconds = qMax(1, seconds);
+    if (!records.isEmpty()) evict();
+}
+
+int FrameHistory::getDuration() const
+{
+    QMutexLocker locker(&mutex);
+    return durationSeconds;
+}
+
+void FrameHistory::setMemoryLimit(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    memoryLimit = qMax<qint64>(16LL * 1024 * 1024, bytes);
+    if (!records.isEmpty()) evict();
+}
+
+qint64 FrameHistory::getMemoryLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return memoryLimit;
+}
+
+void FrameHistory::setKeyframeInterval(int milliseconds)
+{
+    QMutexLocker locker(&mutex);
+    keyframeIntervalMs = qMax(100, milliseconds);
+}
+
+int FrameHistory::getKeyframeInterval() const
+{
+    QMutexLocker locker(&mutex);
+    return keyframeIntervalMs;
+}
+
+void FrameHistory::setDecodeCacheLimit(qint64 bytes)
+{
+    QMutexLocker locker(&mutex);
+    decodedTiles.setMaxCost(int(qBound<qint64>(0, bytes, std::numeric_limits<int>::max())));
+}
+
+qint64 FrameHistory::getDecodeCacheLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return decodedTiles.maxCost();
+}
+
+void FrameHistory::clear()
+{
+    QMutexLocker locker(&mutex);
+    clearFrames();
+}
+
+void FrameHistory::clearFrames()
+{
+    // Frame ids keep counting so reconstructions of the old frames can never be mistaken for new ones.
+    firstFrameId += records.size();
+    ++generation;
+    records.clear();
+    usedBytes = 0;
+    groupBytes = 0;
+    keyframeTimestampNs = 0;
+    previousFrame = QImage();
+    latestTiles.clear();
+    frameSize = QSize();
+    frameFormat = QImage::Format_Invalid;
+    tileColumns = 0;
+    tileRows = 0;
+    for (Reconstruction &reconstruction : reconstructions) {
+        reconstruction = Reconstruction();
+    }
+    decodedTiles.clear();
+}
+
+void FrameHistory::reset(const QImage &image)
+{
+    clearFrames();
+    frameSize = image.size();
+    frameFormat = image.format();
+    tileColumns = (frameSize.width() + TileSize - 1) / TileSize;
+    tileRows = (frameSize.height() + TileSize - 1) / TileSize;
+    latestTiles = QVector<QByteArray>(tileCount());
+}
+
+int FrameHistory::tileCount() const
+{
+    return tileColumns * tileRows;
+}
+
+QRect FrameHistory::tileRect(int tile) const
+{
+    QRect rect((tile % tileColumns) * TileSize, (tile / tileColumns) * TileSize, TileSize, TileSize);
+    return rect.intersected(QRect(QPoint(0, 0), frameSize));
+}
+
+void FrameHistory::append(const CapturedFrame &frame)
+{
+    const QImage &image = frame.image;
+    if (image.isNull() || image.depth() < 8) return;
+
+    // Appends run one at a time; the history itself is only locked while the tiles to compress
+    // are picked and while the result is published, so readers never wait for the compression.
+    QMutexLocker appendLocker(&appendMutex);
+    QMutexLocker locker(&mutex);
+    QElapsedTimer timer;
+    timer.start();
+
+    if (image.size() != frameSize || image.format() != frameFormat) {
+        reset(image);
+    }
+
+    // Only tiles under the frame's dirty rectangles can have changed; the comparison with the
+    // previous frame drops the ones that did not.
+    QVector<TileJob> jobs;
+    if (previousFrame.isNull()) {
+        for (int tile = 0; tile < tileCount(); ++tile) {
+            jobs.append(TileJob{tile, tileRect(tile), QByteArray()});
+        }
+    } else {
+        QVector<bool> marked(tileCount(), false);
+        for (const QRect &rect : frame.dirtyRects) {
+            QRect area = rect.intersected(image.rect());
+            if (area.isEmpty()) continue;
+
+            for (int row = area.top() / TileSize; row <= area.bottom() / TileSize; ++row) {
+                for (int column = area.left() / TileSize; column <= area.right() / TileSize; ++column) {
+                    marked[row * tileColumns + column] = true;
+                }
+            }
+        }
+        for (int tile = 0; tile < tileCount(); ++tile) {
+            if (marked[tile]) {
+                jobs.append(TileJob{tile, tileRect(tile), QByteArray()});
+            }
+        }
+    }
+
+    const QImage previous = previousFrame;
+    const quint64 startGeneration = generation;
+    locker.unlock();
+
+    encodeTiles(jobs, image, previous);
+
+    locker.relock();
+    if (generation != startGeneration) return; // cleared meanwhile
+    previousFrame = image;
+
+    const bool keyframe = records.isEmpty()
+                          || frame.timestampNs - keyframeTimestampNs >= qint64(keyframeIntervalMs) * 1000000
+                          || groupBytes >= memoryLimit / 8;
+
+    Record record;
+    record.sequence = frame.sequence;
+    record.timestampNs = frame.timestampNs;
+    record.keyframe = keyframe;
+    for (const TileJob &job : jobs) {
+        if (job.data.isEmpty()) continue;
+
+        record.tiles.append(job.tile);
+        record.bytes += job.data.size() + EntryOverhead;
+        latestTiles[job.tile] = job.data;
+        if (!keyframe) {
+            record.data.append(job.data);
+        }
+    }
+
+    if (!keyframe && record.tiles.isEmpty()) {
+        appendNs = timer.nsecsElapsed();
+        return;
+    }
+
+    if (keyframe) {
+        // Unchanged tiles are shared with the frames before, so a keyframe only costs its references.
+        record.data = latestTiles;
+        record.bytes += qint64(tileCount() - record.tiles.size()) * EntryOverhead;
+        keyframeTimestampNs = frame.timestampNs;
+        groupBytes = 0;
+    }
+
+    groupBytes += record.bytes;
+    usedBytes += record.bytes;
+    records.append(record);
+    evict();
+
+    appendNs = timer.nsecsElapsed();
+}
+
+void FrameHistory::evict()
+{
+    const qint64 windowNs = qint64(durationSeconds) * 1000000000;
+
+    // History is dropped a whole keyframe group at a time so the oldest frame kept is always a keyframe.
+    while (true) {
+        int nextKeyframe = 1;
+        while (nextKeyframe < records.size() && !records[nextKeyframe].keyframe) {
+            ++nextKeyframe;
+        }
+        if (nextKeyframe >= records.size()) break;
+
+        bool expired = records[nextKeyframe].timestampNs <= records.last().timestampNs - windowNs;
+        if (!expired && usedBytes <= memoryLimit) break;
+
+        evictOldestGroup(nextKeyframe);
+    }
+}
+
+void FrameHistory::evictOldestGroup(int nextKeyframe)
+{
+    QSet<const char *> groupData;
+    qint64 freed = 0;
+    for (int i = 0; i < nextKeyframe; ++i) {
+        freed += records[i].bytes;
+        for (const QByteArray &data : records[i].data) {
+            groupData.insert(data.constData());
+        }
+    }
+
+    // Tiles the next keyframe still shares stay alive; their cost moves over to it.
+    Record &keyframe = records[nextKeyframe];
+    qint64 retained = 0;
+    for (const QByteArray &data : keyframe.data) {
+        if (groupData.contains(data.constData())) {
+            retained += data.size();
+        }
+    }
+    keyframe.bytes += retained;
+
+    usedBytes -= freed - retained;
+    records.remove(0, nextKeyframe);
+    firstFrameId += nextKeyframe;
+}
+
+int FrameHistory::frameCount() const
+{
+    QMutexLocker locker(&mutex);
+    return records.size();
+}
+
+qint64 FrameHistory::memoryUsage() const
+{
+    QMutexLocker locker(&mutex);
+    return usedBytes;
+}
+
+quint64 FrameHistory::sequence(int index) const
+{
+    QMutexLocker locker(&mutex);
+    return index >= 0 && index < records.size() ? records[index].sequence : 0;
+}
+
+qint64 FrameHistory::timestampNs(int index) const
+{
+    QMutexLocker locker(&mutex);
+    return index >= 0 && index < records.size() ? records[index].timestampNs : 0;
+}
+
+int FrameHistory::indexOf(quint64 sequence) const
+{
+    QMutexLocker locker(&mutex);
+    auto it = std::lower_bound(records.constBegin(), records.constEnd(), sequence,
+                               [](const Record &record, quint64 value) { return record.sequence < value; });
+    if (it == records.constEnd() || it->sequence != sequence) return -1;
+    return int(it - records.constBegin());
+}
+
+QImage FrameHistory::frameAt(int index, quint64 *sequence)
+{
+    // Like append(), the tiles are decoded without holding the history lock.
+    QMutexLocker reconstructLocker(&reconstructMutex);
+    QMutexLocker locker(&mutex);
+    if (index < 0 || index >= records.size()) return QImage();
+    if (sequence) *sequence = records[index].sequence;
+
+    QElapsedTimer timer;
+    timer.start();
+    const qint64 frameId = firstFrameId + index;
+
+    for (int i = 0; i < 2; ++i) {
+        if (reconstructions[i].frameId == frameId) {
+            lastReconstruction = i;
+            reconstructNs = timer.nsecsElapsed();
+            return reconstructions[i].image;
+        }
+    }
+
+    // The other buffer is updated so the image last handed out is never written to. Only tiles
+    // that changed between its frame and the requested one are decoded.
+    const int targetIndex = 1 - lastReconstruction;
+    Reconstruction &target = reconstructions[targetIndex];
+    int baseIndex = int(target.frameId - firstFrameId);
+    QImage image;
+    QImage newest;
+    if (target.frameId < firstFrameId || baseIndex >= records.size()
+        || target.image.size() != frameSize || target.image.format() != frameFormat) {
+        // Scrubbing usually starts next to the newest frame, which is still held, so start from a copy of it.
+        newest = previousFrame;
+        baseIndex = records.size() - 1;
+    } else {
+        image = target.image;
+    }
+    // Taken out while it is written to, so the buffer is not shared and the id cannot match by mistake.
+    target = Reconstruction();
+
+    QVector<bool> needed(tileCount(), false);
+    int remaining = 0;
+    for (int i = qMin(baseIndex, index) + 1; i <= qMax(baseIndex, index); ++i) {
+        for (int tile : records[i].tiles) {
+            if (!needed[tile]) {
+                needed[tile] = true;
+                ++remaining;
+            }
+        }
+    }
+
+    // Walk back to the keyframe, taking the newest version of every tile still needed.
+    QVector<TileJob> jobs;
+    for (int i = index; i >= 0 && remaining > 0; --i) {
+        const Record &record = records[i];
+        if (record.keyframe) {
+            for (int tile = 0; tile < tileCount(); ++tile) {
+                if (needed[tile]) {
+                    jobs.append(TileJob{tile, tileRect(tile), record.data[tile]});
+                }
+            }
+            break;
+        }
+
+        for (int j = 0; j < record.tiles.size(); ++j) {
+            int tile = record.tiles[j];
+            if (needed[tile]) {
+                needed[tile] = false;
+                --remaining;
+                jobs.append(TileJob{tile, tileRect(tile), record.data[j]});
+            }
+        }
+    }
+
+    for (TileJob &job : jobs) {
+        if (const DecodedTile *cached = decodedTiles.object(job.data.constData())) {
+            job.raw = cached->raw;
+        }
+    }
+
+    const quint64 startGeneration = generation;
+    locker.unlock();
+
+    if (!newest.isNull()) {
+        image = newest.copy();
+    }
+    if (!jobs.isEmpty()) {
+        decodeTiles(jobs, image);
+    }
+
+    locker.relock();
+    if (generation != startGeneration) return QImage(); // cleared meanwhile
+
+    for (const TileJob &job : jobs) {
+        if (!job.raw.isEmpty() && !decodedTiles.contains(job.data.constData())) {
+            decodedTiles.insert(job.data.constData(), new DecodedTile{job.data, job.raw},
+                                job.raw.size() + job.data.size());
+        }
+    }
+
+    reconstructions[targetIndex].image = image;
+    reconstructions[targetIndex].frameId = frameId;
+    lastReconstruction = targetIndex;
+    reconstructNs = timer.nsecsElapsed();
+    return image;
+}
+
+qint64 FrameHistory::lastAppendNs() const
+{
+    QMutexLocker locker(&mutex);
+    return appendNs;
+}
+
+qint64 FrameHistory::lastReconstructNs() const
+{
+    QMutexLocker locker(&mutex);
+    return reconstructNs;
+}
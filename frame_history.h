@@ -0,0 +1,111 @@
+#ifndef FRAME_HISTORY_H
+#define FRAME_HISTORY_H
+
+#include <QByteArray>
+#include <QCache>
+#include <QImage>
+#include <QMutex>
+#include <QVector>
+
+#include "captured_frame.h"
+#include "dirty_tile_tracker.h"
+
+// Recent frames kept as compressed tiles: a keyframe references every tile, the frames after it
+// only the tiles that changed. Unchanged tiles share their compressed data between keyframes.
+// Safe to use from several threads: compressing and decoding run outside the lock, so frames can
+// be appended on one worker while another rebuilds an older frame and the GUI reads the counts.
+class FrameHistory
+{
+public:
+    static constexpr int TileSize = DirtyTileTracker::TileSize;
+
+    FrameHistory();
+
+    void setDuration(int seconds);
+    int getDuration() const;
+    // Counts the compressed tiles only, not the decode cache or the reconstruction buffers.
+    void setMemoryLimit(qint64 bytes);
+    qint64 getMemoryLimit() const;
+    void setKeyframeInterval(int milliseconds);
+    int getKeyframeInterval() const;
+    // Recently decoded tiles are kept, so scrubbing back and forth mostly copies instead of inflating.
+    void setDecodeCacheLimit(qint64 bytes);
+    qint64 getDecodeCacheLimit() const;
+
+    void clear();
+    void append(const CapturedFrame &frame);
+
+    int frameCount() const;
+    qint64 memoryUsage() const;
+    quint64 sequence(int index) const;
+    qint64 timestampNs(int index) const;
+    int indexOf(quint64 sequence) const;
+
+    // Index 0 is the oldest frame kept. The sequence is returned with the image, since an
+    // append on another thread can shift the indices between two calls.
+    QImage frameAt(int index, quint64 *sequence = nullptr);
+
+    qint64 lastAppendNs() const;
+    qint64 lastReconstructNs() const;
+
+private:
+    struct Record
+    {
+        quint64 sequence = 0;
+        qint64 timestampNs = 0;
+        bool keyframe = false;
+        QVector<int> tiles;       // tiles that changed in this frame
+        QVector<QByteArray> data; // one per changed tile, or every tile in order for keyframes
+        qint64 bytes = 0;         // compressed data owned by this record
+    };
+
+    struct Reconstruction
+    {
+        QImage image;
+        qint64 frameId = -1;
+    };
+
+    struct DecodedTile
+    {
+        QByteArray data; // holds the compressed data, so its address stays unique while cached
+        QByteArray raw;
+    };
+
+    void clearFrames();
+    void reset(const QImage &image);
+    int tileCount() const;
+    QRect tileRect(int tile) const;
+    void evict();
+    void evictOldestGroup(int nextKeyframe);
+
+    int durationSeconds;
+    qint64 memoryLimit;
+    int keyframeIntervalMs;
+
+    QSize frameSize;
+    QImage::Format frameFormat;
+    int tileColumns;
+    int tileRows;
+
+    QVector<Record> records;
+    qint64 firstFrameId;
+    quint64 generation; // bumped by clear(), so work started before it is dropped
+    qint64 usedBytes;
+    qint64 groupBytes;
+    qint64 keyframeTimestampNs;
+    QImage previousFrame;
+    QVector<QByteArray> latestTiles;
+
+    Reconstruction reconstructions[2];
+    int lastReconstruction;
+    QCache<const char *, DecodedTile> decodedTiles;
+
+    mutable QMutex mutex;
+    QMutex appendMutex;
+    QMutex reconstructMutex;
+
+    qint64 appendNs;
+    qint64 reconstructNs;
+};
+
+#endif
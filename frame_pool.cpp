@@ -0,0 +1,126 @@
+#include "frame_pool.h"
+
+#include <cstring>
+
+FramePool::FramePool(int bufferCount)
+    : buffers(qMax(2, bufferCount)),
+    staleRegions(qMax(2, bufferCount)),
+    currentIndex(-1),
+    bufferFormat(QImage::Format_Invalid),
+    sharedCopyCount(0)
+{
+}
+
+void FramePool::reset()
+{
+    for (int i = 0; i < buffers.size(); ++i) {
+        buffers[i] = QImage();
+        staleRegions[i] = QRegion();
+    }
+    currentIndex = -1;
+    bufferSize = QSize();
+    bufferFormat = QImage::Format_Invalid;
+}
+
+bool FramePool::isValid() const
+{
+    return currentIndex >= 0;
+}
+
+QSize FramePool::size() const
+{
+    return bufferSize;
+}
+
+QImage::Format FramePool::format() const
+{
+    return bufferFormat;
+}
+
+const QImage &FramePool::current() const
+{
+    static const QImage nullImage;
+    return isValid() ? buffers[currentIndex] : nullImage;
+}
+
+int FramePool::advance(const QRegion &dirty)
+{
+    int next = (currentIndex + 1) % buffers.size();
+    for (int i = 0; i < buffers.size(); ++i) {
+        if (i != next) {
+            staleRegions[i] += dirty;
+        }
+    }
+    staleRegions[next] = QRegion();
+    return next;
+}
+
+QImage &FramePool::adopt(QImage &&image, const QRegion &dirty)
+{
+    if (image.size() != bufferSize || image.format() != bufferFormat) {
+        reset();
+        bufferSize = image.size();
+        bufferFormat = image.format();
+    }
+
+    int next = advance(dirty);
+    buffers[next] = std::move(image);
+    currentIndex = next;
+    return buffers[currentIndex];
+}
+
+QImage &FramePool::beginFrame(const QRegion &dirty)
+{
+    Q_ASSERT(isValid());
+
+    int previous = currentIndex;
+    QRegion stale = staleRegions[(currentIndex + 1) % buffers.size()];
+    int next = advance(dirty);
+
+    QImage &target = buffers[next];
+    if (target.isNull()) {
+        target = buffers[previous].copy();
+    } else {
+        // A consumer still holding this buffer makes the first write below detach it.
+        if (!target.isDetached()) {
+            sharedCopyCount++;
+        }
+        for (const QRect &rect : stale - dirty) {
+            copyRect(target, buffers[previous], rect);
+        }
+    }
+
+    currentIndex = next;
+    return target;
+}
+
+quint64 FramePool::sharedCopies() const
+{
+    return sharedCopyCount;
+}
+
+void FramePool::resetStats()
+{
+    sharedCopyCount = 0;
+}
+
+void FramePool::copyRect(QImage &target, const QImage &source, const QRect &rect, const QPoint &sourceOrigin)
+{
+    QRect area = rect.intersected(target.rect()).intersected(source.rect().translated(sourceOrigin));
+    if (area.isEmpty()) return;
+
+    const int bytesPerPixel = target.depth() / 8;
+    const int offset = area.x() * bytesPerPixel;
+    const int length = area.width() * bytesPerPixel;
+    const int targetStride = target.bytesPerLine();
+    const int sourceStride = source.bytesPerLine();
+
+    uchar *dst = target.bits() + qint64(area.y()) * targetStride + offset;
+    const uchar *src = source.constBits() + qint64(area.y() - sourceOrigin.y()) * sourceStride
+                       + (area.x() - sourceOrigin.x()) * bytesPerPixel;
+    for (int y = 0; y < area.height(); ++y) {
+        std::memcpy(dst, src, length);
+        dst += targetStride;
+        src += sourceStride;
+    }
+}
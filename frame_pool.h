@@ -0,0 +1,40 @@
+#ifndef FRAME_POOL_H
+#define FRAME_POOL_H
+
+#include <QImage>
+#include <QRegion>
+#include <QVector>
+
+class FramePool
+{
+public:
+    explicit FramePool(int bufferCount = 3);
+
+    void reset();
+    bool isValid() const;
+    QSize size() const;
+    QImage::Format format() const;
+
+    QImage &adopt(QImage &&image, const QRegion &dirty);
+    QImage &beginFrame(const QRegion &dirty);
+    const QImage &current() const;
+
+    // Buffers that were still referenced elsewhere when reused, and so were copied in full.
+    quint64 sharedCopies() const;
+    void resetStats();
+
+    static void copyRect(QImage &target, const QImage &source, const QRect &rect,
+                         const QPoint &sourceOrigin = QPoint());
+
+private:
+    int advance(const QRegion &dirty);
+
+    QVector<QImage> buffers;
+    QVector<QRegion> staleRegions;
+    int currentIndex;
+    QSize bufferSize;
+    QImage::Format bufferFormat;
+    quint64 sharedCopyCount;
+};
+
+#endif
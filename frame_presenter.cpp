@@ -0,0 +1,182 @@
+#include "frame_presenter.h"
+#include "captured_frame.h"
+
+#include <QEvent>
+#include <QScreen>
+#include <QtMath>
+
+namespace {
+
+const int HistorySize = 240;
+const int RequestTimeoutMs = 100;
+
+}
+
+FramePresenter::FramePresenter(QWidget *widget)
+    : QObject(widget),
+    widget(widget),
+    pendingChanges(NoChange),
+    updateRequested(false),
+    requestTimer(new QTimer(this)),
+    readySequence(0),
+    readyCaptureNs(0),
+    readyNs(0),
+    presentedSequence(0),
+    nextRecord(0)
+{
+    records.reserve(HistorySize);
+
+    // An update request can get lost, e.g. while the window is unmapped; ask again after a while.
+    requestTimer->setSingleShot(true);
+    requestTimer->setInterval(RequestTimeoutMs);
+    connect(requestTimer, &QTimer::timeout, this, &FramePresenter::onRequestTimeout);
+}
+
+QWindow *FramePresenter::targetWindow()
+{
+    QWindow *handle = widget->window()->windowHandle();
+    if (handle != window) {
+        if (window) {
+            window->removeEventFilter(this);
+        }
+        window = handle;
+        if (window) {
+            window->installEventFilter(this);
+        }
+    }
+    return window;
+}
+
+void FramePresenter::requestPresent(Changes changes)
+{
+    pendingChanges |= changes;
+    if (!widget->isVisible() || updateRequested) return;
+
+    issueRequest();
+}
+
+void FramePresenter::issueRequest()
+{
+    QWindow *handle = targetWindow();
+    if (!handle) {
+        widget->update();
+        return;
+    }
+
+    handle->requestUpdate();
+    updateRequested = true;
+    requestTimer->start();
+}
+
+void FramePresenter::onRequestTimeout()
+{
+    if (!updateRequested) return;
+
+    updateRequested = false;
+    if (pendingChanges != NoChange && widget->isVisible()) {
+        issueRequest();
+    }
+}
+
+bool FramePresenter::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == window && event->type() == QEvent::UpdateRequest) {
+        // Only paints that answer our own update request count as presents; expose and resize
+        // paints would skew the statistics.
+        const bool requested = updateRequested;
+        updateRequested = false;
+        requestTimer->stop();
+        if (requested && pendingChanges != NoChange && widget->isVisible()) {
+            pendingChanges = NoChange;
+            widget->repaint();
+            notePresented();
+        }
+    }
+
+    return QObject::eventFilter(watched, event);
+}
+
+void FramePresenter::noteFrameReady(quint64 sequence, qint64 captureTimestampNs)
+{
+    readySequence = sequence;
+    readyCaptureNs = captureTimestampNs;
+    readyNs = CapturedFrame::currentTimestampNs();
+}
+
+void FramePresenter::notePresented()
+{
+    PresentRecord record;
+    record.presentNs = CapturedFrame::currentTimestampNs();
+    record.readyNs = readyNs;
+    record.captureNs = readyCaptureNs;
+    record.sequence = readySequence;
+    record.newFrame = readySequence != presentedSequence;
+    presentedSequence = readySequence;
+
+    if (records.size() < HistorySize) {
+        records.append(record);
+    } else {
+        records[nextRecord] = record;
+    }
+    nextRecord = (nextRecord + 1) % HistorySize;
+}
+
+PresentStats FramePresenter::stats() const
+{
+    PresentStats stats;
+    if (records.isEmpty()) return stats;
+
+    QScreen *screen = widget->window()->windowHandle() ? widget->window()->windowHandle()->screen() : nullptr;
+    stats.refreshRate = screen ? screen->refreshRate() : 60.0;
+    const double periodNs = 1e9 / qMax(1.0, stats.refreshRate);
+
+    int count = records.size();
+    int first = count < HistorySize ? 0 : nextRecord;
+
+    const PresentRecord *previousFrame = nullptr;
+    double latencySum = 0.0;
+    double deviationSum = 0.0;
+    double deviationSquares = 0.0;
+    int deviations = 0;
+
+    for (int i = 0; i < count; ++i) {
+        const PresentRecord &record = records[(first + i) % count];
+        stats.presents++;
+        if (!record.newFrame) continue;
+
+        stats.framePresents++;
+        latencySum += (record.presentNs - record.captureNs) / 1e6;
+        stats.missedRefreshes += int((record.presentNs - record.readyNs) / periodNs);
+
+        if (previousFrame) {
+            if (record.sequence > previousFrame->sequence + 1) {
+                stats.skippedFrames += int(record.sequence - previousFrame->sequence - 1);
+            }
+
+            double presentInterval = (record.presentNs - previousFrame->presentNs) / 1e6;
+            double captureInterval = (record.captureNs - previousFrame->captureNs) / 1e6;
+            double deviation = presentInterval - captureInterval;
+            deviationSum += deviation;
+            deviationSquares += deviation * deviation;
+            deviations++;
+        }
+        previousFrame = &record;
+    }
+
+    const PresentRecord &oldest = records[first];
+    const PresentRecord &newest = records[(first + count - 1) % count];
+    double spanSeconds = (newest.presentNs - oldest.presentNs) / 1e9;
+    if (spanSeconds > 0) {
+        stats.presentFps = (count - 1) / spanSeconds;
+    }
+
+    if (stats.framePresents > 0) {
+        stats.avgLatencyMs = latencySum / stats.framePresents;
+    }
+    if (deviations > 1) {
+        double mean = deviationSum / deviations;
+        stats.judderMs = qSqrt(qMax(0.0, deviationSquares / deviations - mean * mean));
+    }
+
+    return stats;
+}
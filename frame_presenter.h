@@ -0,0 +1,79 @@
+#ifndef FRAME_PRESENTER_H
+#define FRAME_PRESENTER_H
+
+#include <QObject>
+#include <QWidget>
+#include <QWindow>
+#include <QPointer>
+#include <QTimer>
+#include <QVector>
+
+struct PresentStats
+{
+    int presents = 0;
+    int framePresents = 0;
+    int skippedFrames = 0;
+    int missedRefreshes = 0;
+    double refreshRate = 0.0;
+    double presentFps = 0.0;
+    double avgLatencyMs = 0.0;
+    double judderMs = 0.0;
+};
+
+class FramePresenter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Change {
+        NoChange = 0x0,
+        FrameChange = 0x1,
+        CursorChange = 0x2,
+        OverlayChange = 0x4
+    };
+    Q_DECLARE_FLAGS(Changes, Change)
+
+    explicit FramePresenter(QWidget *widget);
+
+    void requestPresent(Changes changes);
+
+    void noteFrameReady(quint64 sequence, qint64 captureTimestampNs);
+
+    PresentStats stats() const;
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
+private:
+    struct PresentRecord
+    {
+        qint64 presentNs;
+        qint64 readyNs;
+        qint64 captureNs;
+        quint64 sequence;
+        bool newFrame;
+    };
+
+    QWindow *targetWindow();
+    void issueRequest();
+    void onRequestTimeout();
+    void notePresented();
+
+    QWidget *widget;
+    QPointer<QWindow> window;
+    Changes pendingChanges;
+    bool updateRequested;
+    QTimer *requestTimer;
+
+    quint64 readySequence;
+    qint64 readyCaptureNs;
+    qint64 readyNs;
+    quint64 presentedSequence;
+
+    QVector<PresentRecord> records;
+    int nextRecord;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(FramePresenter::Changes)
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef FRAME_SHM_LAYOUT_H
+#define FRAME_SHM_LAYOUT_H
+
+#include <QtGlobal>
+
+#include <atomic>
+
+// Layout of the shared-memory frame ring written by FrameShmWriter.
+//
+// The segment starts with a Header, followed by slotCount slots of
+// slotStride bytes each. Every slot begins with a SlotHeader and holds the
+// pixel data at SlotHeader::dataOffset. The writer fills slot
+// (frameNumber % slotCount) and never waits for readers: each slot is
+// guarded by a seqlock (version is odd while the slot is being written), so a
+// reader that is still using a slot when it gets recycled detects this by
+// re-checking the version after it is done.
+
+namespace FrameShm {
+
+constexpr quint32 Magic = 0x4644484D;
+constexpr quint32 Version = 3;
+constexpr int DefaultSlotCount = 4;
+constexpr int MaxDirtyRects = 32;
+constexpr int MaxColors = 256;
+constexpr const char *DefaultKey = "MultiDisplayHelper.frames";
+
+enum State : quint32 {
+    StateLive = 0,
+    StateClosed = 1
+};
+
+struct Rect
+{
+    qint32 x;
+    qint32 y;
+    qint32 width;
+    qint32 height;
+};
+
+struct SlotHeader
+{
+    std::atomic<quint64> version;
+    quint64 frameNumber;
+    qint64 timestampNs;
+    Rect screenGeometry;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    qint32 format;
+    qint32 dirtyRectCount;
+    qint32 originX;
+    qint32 originY;
+    Rect dirtyRects[MaxDirtyRects];
+    qint32 colorCount;          // entries used in colorTable, for indexed formats
+    quint32 colorTable[MaxColors];
+    quint64 dataOffset;
+};
+
+struct Header
+{
+    quint32 magic;
+    quint32 version;
+    quint32 slotCount;
+    quint32 headerSize;
+    quint64 slotStride;
+    quint64 slotCapacity;
+    std::atomic<quint64> latestFrame;
+    std::atomic<quint32> state;
+    quint32 reserved;
+};
+
+static_assert(std::atomic<quint64>::is_always_lock_free,
+              "Shared frame ring requires lock-free 64-bit atomics");
+static_assert(std::atomic<quint32>::is_always_lock_free,
+              "Shared frame ring requires lock-free 32-bit atomics");
+
+constexpr quint64 alignUp(quint64 value, quint64 alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+constexpr quint64 slotDataOffset()
+{
+    return alignUp(sizeof(SlotHeader), 64);
+}
+
+constexpr quint64 firstSlotOffset()
+{
+    return alignUp(sizeof(Header), 64);
+}
+
+}
+
+#endif
@@ -0,0 +1,163 @@
+#include "frame_shm_reader.h"
+
+FrameShmReader::FrameShmReader(const QString &key)
+    : memory(key)
+{
+}
+
+FrameShmReader::~FrameShmReader()
+{
+    detach();
+}
+
+bool FrameShmReader::attach()
+{
+    if (memory.isAttached()) {
+        memory.detach();
+    }
+
+    if (!memory.attach(QSharedMemory::ReadOnly)) {
+        lastError = memory.errorString();
+        return false;
+    }
+
+    const quint64 size = quint64(memory.size());
+    if (size < FrameShm::firstSlotOffset()) {
+        lastError = QString("Shared frame buffer too small (%1 bytes)").arg(size);
+        memory.detach();
+        return false;
+    }
+
+    const FrameShm::Header *h = header();
+    if (h->magic != FrameShm::Magic || h->version != FrameShm::Version) {
+        lastError = QString("Unsupported shared frame buffer (magic %1, version %2)")
+                        .arg(h->magic, 8, 16, QChar('0'))
+                        .arg(h->version);
+        memory.detach();
+        return false;
+    }
+
+    // The offsets in the header are only trusted once the segment is known to hold every slot.
+    const quint64 slotBytes = size - FrameShm::firstSlotOffset();
+    if (h->slotCount == 0 || h->slotStride < FrameShm::slotDataOffset() + h->slotCapacity
+        || h->slotCapacity > h->slotStride || h->slotStride > slotBytes / h->slotCount) {
+        lastError = QString("Shared frame buffer of %1 bytes does not hold %2 slots of %3 bytes")
+                        .arg(size)
+                        .arg(h->slotCount)
+                        .arg(h->slotStride);
+        memory.detach();
+        return false;
+    }
+
+    lastError.clear();
+    return true;
+}
+
+void FrameShmReader::detach()
+{
+    if (memory.isAttached()) {
+        memory.detach();
+    }
+}
+
+bool FrameShmReader::isAttached() const
+{
+    return memory.isAttached();
+}
+
+bool FrameShmReader::isWriterClosed() const
+{
+    const FrameShm::Header *h = header();
+    return !h || h->state.load(std::memory_order_acquire) == FrameShm::StateClosed;
+}
+
+QString FrameShmReader::errorString() const
+{
+    return lastError;
+}
+
+const FrameShm::Header *FrameShmReader::header() const
+{
+    if (!memory.isAttached()) return nullptr;
+    return static_cast<const FrameShm::Header *>(memory.constData());
+}
+
+const FrameShm::SlotHeader *FrameShmReader::slot(int index) const
+{
+    const uchar *base = static_cast<const uchar *>(memory.constData());
+    quint64 stride = header()->slotStride;
+    return reinterpret_cast<const FrameShm::SlotHeader *>(base + FrameShm::firstSlotOffset() + stride * index);
+}
+
+quint64 FrameShmReader::latestFrameNumber() const
+{
+    const FrameShm::Header *h = header();
+    return h ? h->latestFrame.load(std::memory_order_acquire) : 0;
+}
+
+FrameShmReader::Frame FrameShmReader::latestFrame() const
+{
+    const FrameShm::Header *h = header();
+    if (!h || h->state.load(std::memory_order_acquire) == FrameShm::StateClosed) {
+        return Frame();
+    }
+
+    quint64 frameNumber = h->latestFrame.load(std::memory_order_acquire);
+    if (frameNumber == 0) return Frame();
+
+    int index = int(frameNumber % h->slotCount);
+    const FrameShm::SlotHeader *s = slot(index);
+
+    quint64 version = s->version.load(std::memory_order_acquire);
+    if (version & 1) return Frame();
+
+    Frame frame;
+    frame.frameNumber = s->frameNumber;
+    frame.timestampNs = s->timestampNs;
+    frame.screenGeometry = QRect(s->screenGeometry.x, s->screenGeometry.y,
+                                 s->screenGeometry.width, s->screenGeometry.height);
+    frame.width = s->width;
+    frame.height = s->height;
+    frame.bytesPerLine = s->bytesPerLine;
+    frame.format = QImage::Format(s->format);
+    frame.origin = QPoint(s->originX, s->originY);
+
+    int dirtyCount = qBound(0, int(s->dirtyRectCount), FrameShm::MaxDirtyRects);
+    frame.dirtyRects.reserve(dirtyCount);
+    for (int i = 0; i < dirtyCount; ++i) {
+        const FrameShm::Rect &rect = s->dirtyRects[i];
+        frame.dirtyRects.append(QRect(rect.x, rect.y, rect.width, rect.height));
+    }
+
+    int colorCount = qBound(0, int(s->colorCount), FrameShm::MaxColors);
+    frame.colorTable.reserve(colorCount);
+    for (int i = 0; i < colorCount; ++i) {
+        frame.colorTable.append(s->colorTable[i]);
+    }
+
+    quint64 dataOffset = s->dataOffset;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s->version.load(std::memory_order_relaxed) != version || frame.frameNumber != frameNumber) {
+        return Frame();
+    }
+
+    if (quint64(frame.bytesPerLine) * quint64(frame.height) > h->slotCapacity
+        || dataOffset < FrameShm::slotDataOffset() || dataOffset > h->slotStride - h->slotCapacity) {
+        return Frame();
+    }
+
+    frame.bits = reinterpret_cast<const uchar *>(s) + dataOffset;
+    frame.slot = index;
+    frame.version = version;
+    return frame;
+}
+
+bool FrameShmReader::isStillValid(const Frame &frame) const
+{
+    if (frame.isNull() || !memory.isAttached()) return false;
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot(frame.slot)->version.load(std::memory_order_relaxed) == frame.version
+           && !isWriterClosed();
+}
@@ -0,0 +1,64 @@
+#ifndef FRAME_SHM_READER_H
+#define FRAME_SHM_READER_H
+
+#include <QSharedMemory>
+#include <QImage>
+#include <QRect>
+#include <QVector>
+
+#include "frame_shm_layout.h"
+
+class FrameShmReader
+{
+public:
+    struct Frame
+    {
+        const uchar *bits = nullptr;
+        int width = 0;
+        int height = 0;
+        int bytesPerLine = 0;
+        QImage::Format format = QImage::Format_Invalid;
+        quint64 frameNumber = 0;
+        qint64 timestampNs = 0;
+        QRect screenGeometry;
+        QPoint origin;
+        QVector<QRect> dirtyRects;
+        QVector<QRgb> colorTable; // set for indexed formats
+
+        int slot = -1;
+        quint64 version = 0;
+
+        bool isNull() const { return bits == nullptr; }
+        QImage image() const
+        {
+            QImage view(bits, width, height, bytesPerLine, format);
+            if (!colorTable.isEmpty()) {
+                view.setColorTable(colorTable);
+            }
+            return view;
+        }
+    };
+
+    explicit FrameShmReader(const QString &key = QString::fromLatin1(FrameShm::DefaultKey));
+    ~FrameShmReader();
+
+    bool attach();
+    void detach();
+    bool isAttached() const;
+    bool isWriterClosed() const;
+
+    quint64 latestFrameNumber() const;
+    Frame latestFrame() const;
+    bool isStillValid(const Frame &frame) const;
+
+    QString errorString() const;
+
+private:
+    const FrameShm::Header *header() const;
+    const FrameShm::SlotHeader *slot(int index) const;
+
+    QSharedMemory memory;
+    QString lastError;
+};
+
+#endif
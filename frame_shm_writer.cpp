@@ -0,0 +1,238 @@
+#include "frame_shm_writer.h"
+#include <QDebug>
+
+#include <cstring>
+#include <new>
+
+namespace {
+
+// A failed create is retried at most this often instead of on every frame.
+constexpr qint64 CreateRetryMs = 1000;
+
+}
+
+FrameShmWriter::FrameShmWriter(const QString &key, int slotCount)
+    : segmentKey(key),
+    memory(nullptr),
+    slotCount(qMax(2, slotCount)),
+    slotCapacity(0),
+    minimumFrameBytes(0),
+    frameCount(0),
+    lastFormat(QImage::Format_Invalid),
+    reportedFailure(false)
+{
+}
+
+FrameShmWriter::~FrameShmWriter()
+{
+    close();
+}
+
+bool FrameShmWriter::isOpen() const
+{
+    return memory && memory->isAttached();
+}
+
+QString FrameShmWriter::key() const
+{
+    return segmentKey;
+}
+
+quint64 FrameShmWriter::publishedFrames() const
+{
+    return frameCount;
+}
+
+FrameShm::Header *FrameShmWriter::header() const
+{
+    return static_cast<FrameShm::Header *>(memory->data());
+}
+
+FrameShm::SlotHeader *FrameShmWriter::slot(int index) const
+{
+    uchar *base = static_cast<uchar *>(memory->data());
+    quint64 stride = header()->slotStride;
+    return reinterpret_cast<FrameShm::SlotHeader *>(base + FrameShm::firstSlotOffset() + stride * index);
+}
+
+uchar *FrameShmWriter::slotData(int index) const
+{
+    return reinterpret_cast<uchar *>(slot(index)) + FrameShm::slotDataOffset();
+}
+
+void FrameShmWriter::close()
+{
+    if (!memory) return;
+
+    if (memory->isAttached()) {
+        header()->state.store(FrameShm::StateClosed, std::memory_order_release);
+        memory->detach();
+    }
+
+    delete memory;
+    memory = nullptr;
+    slotCapacity = 0;
+    lastSize = QSize();
+    staleRegions.clear();
+}
+
+void FrameShmWriter::setMinimumFrameBytes(quint64 bytes)
+{
+    minimumFrameBytes = bytes;
+}
+
+bool FrameShmWriter::ensureCapacity(quint64 frameBytes)
+{
+    if (isOpen() && frameBytes <= slotCapacity) {
+        return true;
+    }
+    if (retryTimer.isValid() && retryTimer.elapsed() < CreateRetryMs) {
+        return false;
+    }
+
+    // Growing means creating the segment again under the same key. With SysV shared memory
+    // (Qt5 on Unix) that fails while any reader is still attached to the old one, which is
+    // why the segment is sized for the largest screen up front.
+    quint64 capacity = FrameShm::alignUp(qMax(qMax(frameBytes, slotCapacity), minimumFrameBytes), 4096);
+    close();
+
+    quint64 stride = FrameShm::slotDataOffset() + capacity;
+    quint64 totalSize = FrameShm::firstSlotOffset() + stride * slotCount;
+
+    memory = new QSharedMemory(segmentKey);
+    if (!memory->create(int(totalSize))) {
+        // A segment left behind by a crashed writer is released once nobody is attached.
+        if (memory->error() == QSharedMemory::AlreadyExists && memory->attach()) {
+            memory->detach();
+        }
+
+        if (!memory->create(int(totalSize))) {
+            if (!reportedFailure) {
+                qDebug() << "Failed to create shared frame buffer" << segmentKey
+                         << "Error:" << memory->errorString();
+                reportedFailure = true;
+            }
+            delete memory;
+            memory = nullptr;
+            retryTimer.start();
+            return false;
+        }
+    }
+
+    std::memset(memory->data(), 0, FrameShm::firstSlotOffset());
+
+    FrameShm::Header *h = new (memory->data()) FrameShm::Header;
+    h->magic = FrameShm::Magic;
+    h->version = FrameShm::Version;
+    h->slotCount = quint32(slotCount);
+    h->headerSize = quint32(FrameShm::firstSlotOffset());
+    h->slotStride = stride;
+    h->slotCapacity = capacity;
+    h->latestFrame.store(0, std::memory_order_relaxed);
+    h->state.store(FrameShm::StateLive, std::memory_order_relaxed);
+
+    for (int i = 0; i < slotCount; ++i) {
+        uchar *slotBase = reinterpret_cast<uchar *>(memory->data()) + FrameShm::firstSlotOffset() + stride * i;
+        std::memset(slotBase, 0, FrameShm::slotDataOffset());
+        FrameShm::SlotHeader *s = new (slotBase) FrameShm::SlotHeader;
+        s->version.store(0, std::memory_order_relaxed);
+        s->dataOffset = FrameShm::slotDataOffset();
+    }
+
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slotCapacity = capacity;
+    staleRegions = QVector<QRegion>(slotCount);
+    lastSize = QSize();
+    reportedFailure = false;
+    retryTimer.invalidate();
+
+    qDebug() << "Shared frame buffer" << segmentKey << "created:" << slotCount
+             << "slots of" << capacity << "bytes";
+    return true;
+}
+
+bool FrameShmWriter::publish(const CapturedFrame &frame)
+{
+    const QImage &image = frame.image;
+    if (image.isNull()) return false;
+
+    quint64 frameBytes = quint64(image.bytesPerLine()) * quint64(image.height());
+    if (!ensureCapacity(frameBytes)) return false;
+
+    QRect fullRect(QPoint(0, 0), image.size());
+    if (image.size() != lastSize || image.format() != lastFormat) {
+        for (QRegion &stale : staleRegions) {
+            stale = fullRect;
+        }
+        lastSize = image.size();
+        lastFormat = image.format();
+    } else {
+        for (QRegion &stale : staleRegions) {
+            for (const QRect &rect : frame.dirtyRects) {
+                stale += rect;
+            }
+        }
+    }
+
+    FrameShm::Header *h = header();
+    quint64 frameNumber = frameCount + 1;
+    int index = int(frameNumber % quint64(slotCount));
+    FrameShm::SlotHeader *s = slot(index);
+
+    quint64 version = s->version.load(std::memory_order_relaxed);
+    s->version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    s->frameNumber = frameNumber;
+    s->timestampNs = frame.timestampNs;
+    s->screenGeometry = { frame.screenGeometry.x(), frame.screenGeometry.y(),
+                          frame.screenGeometry.width(), frame.screenGeometry.height() };
+    s->width = image.width();
+    s->height = image.height();
+    s->bytesPerLine = image.bytesPerLine();
+    s->format = int(image.format());
+    s->originX = frame.origin.x();
+    s->originY = frame.origin.y();
+
+    int dirtyCount = qMin(int(frame.dirtyRects.size()), FrameShm::MaxDirtyRects);
+    if (frame.dirtyRects.size() > FrameShm::MaxDirtyRects) {
+        QRect bounds;
+        for (const QRect &rect : frame.dirtyRects) {
+            bounds = bounds.united(rect);
+        }
+        s->dirtyRects[0] = { bounds.x(), bounds.y(), bounds.width(), bounds.height() };
+        dirtyCount = 1;
+    } else {
+        for (int i = 0; i < dirtyCount; ++i) {
+            const QRect &rect = frame.dirtyRects[i];
+            s->dirtyRects[i] = { rect.x(), rect.y(), rect.width(), rect.height() };
+        }
+    }
+    s->dirtyRectCount = dirtyCount;
+
+    const QVector<QRgb> colorTable = image.colorTable();
+    const int colorCount = qMin(int(colorTable.size()), FrameShm::MaxColors);
+    if (colorCount > 0) {
+        std::memcpy(s->colorTable, colorTable.constData(), colorCount * sizeof(quint32));
+    }
+    s->colorCount = colorCount;
+
+    uchar *data = slotData(index);
+    const int bytesPerPixel = image.depth() / 8;
+    const int bytesPerLine = image.bytesPerLine();
+    for (const QRect &rect : staleRegions[index].intersected(fullRect)) {
+        const int offset = rect.x() * bytesPerPixel;
+        const int length = rect.width() * bytesPerPixel;
+        for (int y = rect.top(); y <= rect.bottom(); ++y) {
+            std::memcpy(data + qint64(y) * bytesPerLine + offset, image.constScanLine(y) + offset, length);
+        }
+    }
+    staleRegions[index] = QRegion();
+
+    s->version.store(version + 2, std::memory_order_release);
+    h->latestFrame.store(frameNumber, std::memory_order_release);
+
+    frameCount = frameNumber;
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef FRAME_SHM_WRITER_H
+#define FRAME_SHM_WRITER_H
+
+#include <QSharedMemory>
+#include <QElapsedTimer>
+#include <QRegion>
+#include <QVector>
+
+#include "captured_frame.h"
+#include "frame_shm_layout.h"
+
+class FrameShmWriter
+{
+public:
+    explicit FrameShmWriter(const QString &key = QString::fromLatin1(FrameShm::DefaultKey),
+                            int slotCount = FrameShm::DefaultSlotCount);
+    ~FrameShmWriter();
+
+    void setMinimumFrameBytes(quint64 bytes);
+    bool publish(const CapturedFrame &frame);
+    void close();
+
+    bool isOpen() const;
+    QString key() const;
+    quint64 publishedFrames() const;
+
+private:
+    bool ensureCapacity(quint64 frameBytes);
+    FrameShm::Header *header() const;
+    FrameShm::SlotHeader *slot(int index) const;
+    uchar *slotData(int index) const;
+
+    QString segmentKey;
+    QSharedMemory *memory;
+    int slotCount;
+    quint64 slotCapacity;
+    quint64 minimumFrameBytes;
+    quint64 frameCount;
+    QSize lastSize;
+    QImage::Format lastFormat;
+    QVector<QRegion> staleRegions;
+    bool reportedFailure;
+    QElapsedTimer retryTimer;
+};
+
+#endif
@@ -0,0 +1,531 @@
+#include "image_search.h"
+#include "pixel_mode_converter.h"
+#include "simd_support.h"
+
+#include <QtConcurrent>
+#include <QMutex>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace SearchKernels {
+
+void correlate(const uchar *a, int strideA, const uchar *b, int strideB, int width, int height,
+               quint64 *sumB, quint64 *sumBB, quint64 *sumAB)
+{
+    quint64 totalB = 0;
+    quint64 totalBB = 0;
+    quint64 totalAB = 0;
+    int vectorWidth = 0;
+#ifdef MDH_HAVE_SSE2
+    vectorWidth = width & ~7;
+    const __m128i zero = _mm_setzero_si128();
+    __m128i accB = zero;
+    __m128i accBB = zero;
+    __m128i accAB = zero;
+    alignas(16) quint32 lanes[4];
+
+    // A 32-bit lane gains at most 4 * 255 * 255 per step; flush to 64 bits well before it could wrap.
+    const int rowsPerFlush = qMax(1, 8192 / qMax(1, (vectorWidth + 15) / 16));
+    for (int row = 0; row < height; ++row) {
+        const uchar *rowA = a + qint64(row) * strideA;
+        const uchar *rowB = b + qint64(row) * strideB;
+
+        for (int i = 0; i < vectorWidth; i += 16) {
+            __m128i va;
+            __m128i vb;
+            if (i + 16 <= vectorWidth) {
+                va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rowA + i));
+                vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(rowB + i));
+            } else {
+                va = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(rowA + i));
+                vb = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(rowB + i));
+            }
+
+            __m128i aLo = _mm_unpacklo_epi8(va, zero);
+            __m128i aHi = _mm_unpackhi_epi8(va, zero);
+            __m128i bLo = _mm_unpacklo_epi8(vb, zero);
+            __m128i bHi = _mm_unpackhi_epi8(vb, zero);
+
+            accB = _mm_add_epi64(accB, _mm_sad_epu8(vb, zero));
+            accAB = _mm_add_epi32(accAB, _mm_add_epi32(_mm_madd_epi16(aLo, bLo), _mm_madd_epi16(aHi, bHi)));
+            accBB = _mm_add_epi32(accBB, _mm_add_epi32(_mm_madd_epi16(bLo, bLo), _mm_madd_epi16(bHi, bHi)));
+        }
+
+        if ((row + 1) % rowsPerFlush == 0 || row + 1 == height) {
+            _mm_store_si128(reinterpret_cast<__m128i *>(lanes), accAB);
+            totalAB += quint64(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+            _mm_store_si128(reinterpret_cast<__m128i *>(lanes), accBB);
+            totalBB += quint64(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+            accAB = zero;
+            accBB = zero;
+        }
+    }
+    totalB = quint64(quint32(_mm_cvtsi128_si32(accB))) + quint32(_mm_cvtsi128_si32(_mm_srli_si128(accB, 8)));
+#endif
+    if (vectorWidth < width) {
+        for (int row = 0; row < height; ++row) {
+            const uchar *rowA = a + qint64(row) * strideA;
+            const uchar *rowB = b + qint64(row) * strideB;
+            for (int i = vectorWidth; i < width; ++i) {
+                totalB += rowB[i];
+                totalBB += quint32(rowB[i]) * rowB[i];
+                totalAB += quint32(rowA[i]) * rowB[i];
+            }
+        }
+    }
+
+    *sumB = totalB;
+    *sumBB = totalBB;
+    *sumAB = totalAB;
+}
+
+void downsample2x(const uchar *row0, const uchar *row1, uchar *dst, int outWidth)
+{
+    int x = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+    const __m128i one = _mm_set1_epi16(1);
+
+    for (; x + 16 <= outWidth; x += 16) {
+        __m128i v0 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * x)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x)));
+        __m128i v1 = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(row0 + 2 * x + 16)),
+                                  _mm_loadu_si128(reinterpret_cast<const __m128i *>(row1 + 2 * x + 16)));
+
+        __m128i s0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_and_si128(v0, lowBytes),
+                                                                _mm_srli_epi16(v0, 8)), one), 1);
+        __m128i s1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_and_si128(v1, lowBytes),
+                                                                _mm_srli_epi16(v1, 8)), one), 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(s0, s1));
+    }
+#endif
+    for (; x < outWidth; ++x) {
+        int left = (row0[2 * x] + row1[2 * x] + 1) >> 1;
+        int right = (row0[2 * x + 1] + row1[2 * x + 1] + 1) >> 1;
+        dst[x] = uchar((left + right + 1) >> 1);
+    }
+}
+
+}
+
+namespace {
+
+const int MaxCandidates = 256;
+const int CandidateSpacing = 2;
+const int RefineRadius = 2;
+
+struct GrayView
+{
+    const uchar *bits;
+    int stride;
+    int width;
+    int height;
+
+    explicit GrayView(const QImage &image)
+        : bits(image.constBits()), stride(image.bytesPerLine()), width(image.width()), height(image.height())
+    {
+    }
+
+    const uchar *at(int x, int y) const { return bits + qint64(y) * stride + x; }
+};
+
+struct Candidate
+{
+    int x;
+    int y;
+    double score;
+};
+
+// Splits [0, count) into bands and runs them on the global thread pool.
+template <typename Function>
+void forEachBand(int count, int minPerBand, Function function)
+{
+    int bands = qBound(1, count / qMax(1, minPerBand), QThread::idealThreadCount() * 4);
+    if (bands <= 1) {
+        function(0, count);
+        return;
+    }
+
+    QVector<QPair<int, int>> ranges;
+    for (int i = 0; i < bands; ++i) {
+        ranges.append(qMakePair(count * i / bands, count * (i + 1) / bands));
+    }
+    QtConcurrent::blockingMap(ranges, [&function](const QPair<int, int> &range) {
+        function(range.first, range.second);
+    });
+}
+
+double windowNcc(const GrayView &plane, int x, int y, const GrayView &pattern, qint64 sumA, qint64 sumAA)
+{
+    quint64 sumB;
+    quint64 sumBB;
+    quint64 sumAB;
+    SearchKernels::correlate(pattern.bits, pattern.stride, plane.at(x, y), plane.stride,
+                             pattern.width, pattern.height, &sumB, &sumBB, &sumAB);
+
+    const double n = double(pattern.width) * pattern.height;
+    const double varianceA = n * double(sumAA) - double(sumA) * double(sumA);
+    const double varianceB = n * double(sumBB) - double(sumB) * double(sumB);
+
+    // A flat template has no correlation to speak of; compare brightness instead.
+    if (varianceA <= 0.0 || varianceB <= 0.0) {
+        if (varianceA > 0.0 || varianceB > 0.0) return 0.0;
+        return 1.0 - std::abs(double(sumA) - double(sumB)) / (255.0 * n);
+    }
+
+    return (n * double(sumAB) - double(sumA) * double(sumB)) / std::sqrt(varianceA * varianceB);
+}
+
+int levelsFor(const QSize &size)
+{
+    int levels = 1;
+    while (levels < ImageSearch::MaxLevels && (qMin(size.width(), size.height()) >> levels) >= ImageSearch::MinCoarseSide) {
+        levels++;
+    }
+    return levels;
+}
+
+bool isRgb32(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 || format == QImage::Format_ARGB32
+           || format == QImage::Format_ARGB32_Premultiplied;
+}
+
+}
+
+ImageSearch::ImageSearch()
+    : threshold(0.9),
+    maxMatches(16),
+    coarseThreshold(0.6)
+{
+}
+
+int ImageSearch::addTemplate(const QImage &image)
+{
+    if (image.isNull()) return -1;
+
+    Template added;
+    added.levels.append(toGrayscale(image, image.rect()));
+
+    const int levels = levelsFor(image.size());
+    for (int level = 1; level < levels; ++level) {
+        added.levels.append(downsample(added.levels.last()));
+    }
+
+    for (const QImage &level : added.levels) {
+        GrayView view(level);
+        qint64 sum = 0;
+        qint64 sumSquares = 0;
+        for (int y = 0; y < view.height; ++y) {
+            const uchar *line = view.at(0, y);
+            for (int x = 0; x < view.width; ++x) {
+                sum += line[x];
+                sumSquares += line[x] * line[x];
+            }
+        }
+        added.sums.append(sum);
+        added.sumSquares.append(sumSquares);
+    }
+
+    templates.append(added);
+    return templates.size() - 1;
+}
+
+void ImageSearch::clearTemplates()
+{
+    templates.clear();
+}
+
+int ImageSearch::templateCount() const
+{
+    return templates.size();
+}
+
+QSize ImageSearch::templateSize(int index) const
+{
+    return templates.value(index).levels.value(0).size();
+}
+
+void ImageSearch::setThreshold(double score)
+{
+    threshold = qBound(-1.0, score, 1.0);
+}
+
+double ImageSearch::getThreshold() const
+{
+    return threshold;
+}
+
+void ImageSearch::setMaxMatches(int count)
+{
+    maxMatches = qMax(1, count);
+}
+
+int ImageSearch::getMaxMatches() const
+{
+    return maxMatches;
+}
+
+void ImageSearch::setCoarseThreshold(double score)
+{
+    coarseThreshold = qBound(-1.0, score, 1.0);
+}
+
+double ImageSearch::getCoarseThreshold() const
+{
+    return coarseThreshold;
+}
+
+QImage ImageSearch::toGrayscale(const QImage &image, const QRect &rect)
+{
+    QRect area = rect.intersected(image.rect());
+    QImage gray(area.size(), QImage::Format_Grayscale8);
+    if (area.isEmpty()) return gray;
+
+    if (image.format() == QImage::Format_Grayscale8) {
+        for (int y = 0; y < area.height(); ++y) {
+            std::memcpy(gray.scanLine(y), image.constScanLine(area.y() + y) + area.x(), area.width());
+        }
+        return gray;
+    }
+
+    QImage source = image;
+    QPoint origin = area.topLeft();
+    if (!isRgb32(image.format())) {
+        source = image.copy(area).convertToFormat(QImage::Format_RGB32);
+        origin = QPoint(0, 0);
+    }
+
+    const uchar *sourceBits = source.constBits();
+    const int sourceStride = source.bytesPerLine();
+    uchar *target = gray.bits();
+    const int targetStride = gray.bytesPerLine();
+
+    forEachBand(area.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            const quint32 *src = reinterpret_cast<const quint32 *>(sourceBits + qint64(origin.y() + y) * sourceStride)
+                                 + origin.x();
+            PixelKernels::rgb32ToGray8(src, target + qint64(y) * targetStride, area.width());
+        }
+    });
+    return gray;
+}
+
+QImage ImageSearch::downsample(const QImage &gray)
+{
+    QImage half(gray.width() / 2, gray.height() / 2, QImage::Format_Grayscale8);
+    if (half.isNull()) return half;
+
+    // Hold raw pointers so the worker threads never touch QImage's shared data.
+    GrayView source(gray);
+    uchar *target = half.bits();
+    const int targetStride = half.bytesPerLine();
+    const int targetWidth = half.width();
+
+    forEachBand(half.height(), 64, [&](int begin, int end) {
+        for (int y = begin; y < end; ++y) {
+            SearchKernels::downsample2x(source.at(0, 2 * y), source.at(0, 2 * y + 1),
+                                        target + qint64(y) * targetStride, targetWidth);
+        }
+    });
+    return half;
+}
+
+QVector<ImageMatch> ImageSearch::find(const QImage &frame) const
+{
+    return search(frame, QVector<QRect>() << frame.rect());
+}
+
+QVector<ImageMatch> ImageSearch::find(const QImage &frame, const QRegion &searchArea) const
+{
+    QVector<QRect> areas;
+    for (const QRect &rect : searchArea.intersected(frame.rect())) {
+        areas.append(rect);
+    }
+    return search(frame, areas);
+}
+
+QVector<ImageMatch> ImageSearch::find(const CapturedFrame &frame, bool changedOnly) const
+{
+    QVector<ImageMatch> matches;
+    if (changedOnly) {
+        QRegion changed;
+        for (const QRect &rect : frame.dirtyRects) {
+            changed += rect;
+        }
+        matches = find(frame.image, changed);
+    } else {
+        matches = find(frame.image);
+    }
+
+    // Cropped frames start part way into the screen.
+    for (ImageMatch &match : matches) {
+        match.rect.translate(frame.origin);
+    }
+    return matches;
+}
+
+QVector<ImageMatch> ImageSearch::search(const QImage &frame, const QVector<QRect> &areas) const
+{
+    QVector<ImageMatch> matches;
+    if (frame.isNull() || areas.isEmpty() || templates.isEmpty()) return matches;
+
+    // Only the pixels a match touching the search areas could cover are converted.
+    QSize largest;
+    int levels = 1;
+    for (const Template &pattern : templates) {
+        largest = largest.expandedTo(pattern.levels.first().size());
+        levels = qMax(levels, pattern.levels.size());
+    }
+
+    QRect workRect;
+    for (const QRect &area : areas) {
+        workRect |= area.adjusted(1 - largest.width(), 1 - largest.height(),
+                                  largest.width() - 1, largest.height() - 1);
+    }
+    workRect &= frame.rect();
+
+    QVector<QImage> pyramid;
+    pyramid.append(toGrayscale(frame, workRect));
+    for (int level = 1; level < levels; ++level) {
+        pyramid.append(downsample(pyramid.last()));
+    }
+
+    for (int index = 0; index < templates.size(); ++index) {
+        matches += searchTemplate(index, pyramid, areas, workRect.topLeft());
+    }
+
+    std::sort(matches.begin(), matches.end(), [](const ImageMatch &a, const ImageMatch &b) {
+        return a.score > b.score;
+    });
+    return matches;
+}
+
+QVector<ImageMatch> ImageSearch::searchTemplate(int index, const QVector<QImage> &pyramid,
+                                                const QVector<QRect> &areas, const QPoint &origin) const
+{
+    const Template &pattern = templates[index];
+    const int top = pattern.levels.size() - 1;
+    const GrayView coarsePlane(pyramid[top]);
+    const GrayView coarsePattern(pattern.levels[top]);
+    const GrayView basePattern(pattern.levels[0]);
+    const double coarseLimit = qMin(coarseThreshold, threshold);
+
+    // Coarse pass: NCC at the top level over every position that could overlap an area.
+    // Normalising keeps the score stable when downsampling blurs away contrast.
+    QVector<Candidate> candidates;
+    QMutex candidateLock;
+
+    for (const QRect &area : areas) {
+        const QRect local = area.translated(-origin);
+        const int x0 = qMax(0, local.left() - basePattern.width + 1) >> top;
+        const int y0 = qMax(0, local.top() - basePattern.height + 1) >> top;
+        const int x1 = qMin(local.right() >> top, coarsePlane.width - coarsePattern.width);
+        const int y1 = qMin(local.bottom() >> top, coarsePlane.height - coarsePattern.height);
+        if (x1 < x0 || y1 < y0) continue;
+
+        forEachBand(y1 - y0 + 1, 16, [&](int begin, int end) {
+            QVector<Candidate> found;
+            for (int y = y0 + begin; y < y0 + end; ++y) {
+                for (int x = x0; x <= x1; ++x) {
+                    double score = windowNcc(coarsePlane, x, y, coarsePattern,
+                                             pattern.sums[top], pattern.sumSquares[top]);
+                    if (score >= coarseLimit) {
+                        found.append(Candidate{x, y, score});
+                    }
+                }
+            }
+
+            QMutexLocker locker(&candidateLock);
+            candidates += found;
+        });
+    }
+
+    std::sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+        return a.score != b.score ? a.score > b.score : (a.y != b.y ? a.y < b.y : a.x < b.x);
+    });
+
+    // Keep only the strongest candidate in each neighbourhood, so one bright spot cannot crowd out the rest.
+    QVector<Candidate> seeds;
+    for (const Candidate &candidate : candidates) {
+        if (seeds.size() >= MaxCandidates) break;
+
+        bool near = false;
+        for (const Candidate &seed : seeds) {
+            if (std::abs(seed.x - candidate.x) <= CandidateSpacing && std::abs(seed.y - candidate.y) <= CandidateSpacing) {
+                near = true;
+                break;
+            }
+        }
+        if (!near) {
+            seeds.append(candidate);
+        }
+    }
+
+    // Fine passes: follow each seed down the pyramid, re-scoring a small neighbourhood per level.
+    QVector<ImageMatch> refined(seeds.size());
+    forEachBand(seeds.size(), 4, [&](int begin, int end) {
+        for (int i = begin; i < end; ++i) {
+            int x = seeds[i].x;
+            int y = seeds[i].y;
+            double score = seeds[i].score;
+
+            for (int level = top - 1; level >= 0; --level) {
+                const GrayView plane(pyramid[level]);
+                const GrayView levelPattern(pattern.levels[level]);
+                const int maxX = plane.width - levelPattern.width;
+                const int maxY = plane.height - levelPattern.height;
+
+                int bestX = qBound(0, 2 * x, maxX);
+                int bestY = qBound(0, 2 * y, maxY);
+                score = -2.0;
+                for (int dy = -RefineRadius; dy <= RefineRadius; ++dy) {
+                    for (int dx = -RefineRadius; dx <= RefineRadius; ++dx) {
+                        int cx = 2 * x + dx;
+                        int cy = 2 * y + dy;
+                        if (cx < 0 || cy < 0 || cx > maxX || cy > maxY) continue;
+
+                        double candidateScore = windowNcc(plane, cx, cy, levelPattern,
+                                                          pattern.sums[level], pattern.sumSquares[level]);
+                        if (candidateScore > score) {
+                            score = candidateScore;
+                            bestX = cx;
+                            bestY = cy;
+                        }
+                    }
+                }
+                x = bestX;
+                y = bestY;
+            }
+
+            refined[i].templateIndex = index;
+            refined[i].rect = QRect(QPoint(x, y) + origin, pattern.levels[0].size());
+            refined[i].score = score;
+        }
+    });
+
+    std::sort(refined.begin(), refined.end(), [](const ImageMatch &a, const ImageMatch &b) {
+        return a.score > b.score;
+    });
+
+    // Several seeds usually converge on the same spot; keep the best one per location.
+    QVector<ImageMatch> matches;
+    for (const ImageMatch &match : refined) {
+        if (match.score < threshold || matches.size() >= maxMatches) break;
+
+        bool overlaps = false;
+        for (const ImageMatch &kept : matches) {
+            if (kept.rect.contains(match.center())) {
+                overlaps = true;
+                break;
+            }
+        }
+        if (!overlaps) {
+            matches.append(match);
+        }
+    }
+    return matches;
+}
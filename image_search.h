@@ -0,0 +1,80 @@
+#ifndef IMAGE_SEARCH_H
+#define IMAGE_SEARCH_H
+
+#include <QImage>
+#include <QRect>
+#include <QRegion>
+#include <QVector>
+
+#include "captured_frame.h"
+
+struct ImageMatch
+{
+    int templateIndex = -1;
+    QRect rect;
+    double score = 0.0;
+
+    // rect is in captured pixels of the screen. MouseController works in logical screen
+    // coordinates, so pass it logicalRect(frame.devicePixelRatio).center().
+    QPoint center() const { return rect.center(); }
+    QRect logicalRect(qreal devicePixelRatio) const
+    {
+        return QRectF(rect.x() / devicePixelRatio, rect.y() / devicePixelRatio,
+                      rect.width() / devicePixelRatio, rect.height() / devicePixelRatio).toRect();
+    }
+};
+
+class ImageSearch
+{
+public:
+    static constexpr int MaxLevels = 4;
+    static constexpr int MinCoarseSide = 6;
+
+    ImageSearch();
+
+    int addTemplate(const QImage &image);
+    void clearTemplates();
+    int templateCount() const;
+    QSize templateSize(int index) const;
+
+    void setThreshold(double score);
+    double getThreshold() const;
+    void setMaxMatches(int count);
+    int getMaxMatches() const;
+    void setCoarseThreshold(double score);
+    double getCoarseThreshold() const;
+
+    QVector<ImageMatch> find(const QImage &frame) const;
+    QVector<ImageMatch> find(const QImage &frame, const QRegion &searchArea) const;
+    QVector<ImageMatch> find(const CapturedFrame &frame, bool changedOnly = false) const;
+
+    static QImage toGrayscale(const QImage &image, const QRect &rect);
+    static QImage downsample(const QImage &gray);
+
+private:
+    struct Template
+    {
+        QVector<QImage> levels;
+        QVector<qint64> sums;
+        QVector<qint64> sumSquares;
+    };
+
+    QVector<ImageMatch> search(const QImage &frame, const QVector<QRect> &areas) const;
+    QVector<ImageMatch> searchTemplate(int index, const QVector<QImage> &pyramid,
+                                       const QVector<QRect> &areas, const QPoint &origin) const;
+
+    QVector<Template> templates;
+    double threshold;
+    int maxMatches;
+    double coarseThreshold;
+};
+
+namespace SearchKernels {
+
+void correlate(const uchar *a, int strideA, const uchar *b, int strideB, int width, int height,
+               quint64 *sumB, quint64 *sumBB, quint64 *sumAB);
+void downsample2x(const uchar *row0, const uchar *row1, uchar *dst, int outWidth);
+
+}
+
+#endif
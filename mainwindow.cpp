@@ -1,13 +1,23 @@
 #include "mainwindow.h"
 #include <QDebug>
 #include <QMessageBox>
+#include <QInputDialog>
+#include <QSignalBlocker>
+#include <QtConcurrent>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , screenCapturer(new ScreenCapturer(this))
     , mouseController(new MouseController(this))
     , screenWidget(new ScreenWidget(this))
+    , automationServer(new AutomationServer(mouseController, this))
+    , regionWaiter(new RegionWaiter(screenCapturer, this))
+    , historyWatcher(new QFutureWatcher<void>(this))
+    , historyFrameWatcher(new QFutureWatcher<HistoryFrame>(this))
 {
+    automationServer->setRegionWaiter(regionWaiter);
+    automationServer->setScreenCapturer(screenCapturer);
+
     setupUI();
     setupConnections();
     updateScreenList();
@@ -17,6 +27,8 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    historyWatcher->waitForFinished();
+    historyFrameWatcher->waitForFinished();
 }
 
 void MainWindow::setupUI()
@@ -33,10 +45,32 @@ void MainWindow::setupUI()
     fpsSpinBox = new QSpinBox();
     fpsSpinBox->setRange(1, 60);
     fpsSpinBox->setSuffix(" FPS");
+    pixelModeSelector = new QComboBox();
+    pixelModeSelector->addItem(PixelModeConverter::modeName(PixelModeConverter::Rgb32), PixelModeConverter::Rgb32);
+    pixelModeSelector->addItem(PixelModeConverter::modeName(PixelModeConverter::Rgb565), PixelModeConverter::Rgb565);
+    pixelModeSelector->addItem(PixelModeConverter::modeName(PixelModeConverter::Grayscale8), PixelModeConverter::Grayscale8);
+    pixelModeSelector->addItem(PixelModeConverter::modeName(PixelModeConverter::Palette8), PixelModeConverter::Palette8);
+    pixelModeSelector->setToolTip("Pixel format frames are kept in after capture");
+    shareFramesCheckBox = new QCheckBox("Share frames");
+    shareFramesCheckBox->setToolTip(QString("Publish captured frames to shared memory (key: %1)")
+                                        .arg(FrameShm::DefaultKey));
+    grayscaleCheckBox = new QCheckBox("Grayscale");
+    captureOnChangeCheckBox = new QCheckBox("On change");
+    captureOnChangeCheckBox->setToolTip("Capture only when the screen changes (X11 Damage), "
+                                        "using the target FPS as an upper bound");
+    captureOnChangeCheckBox->setEnabled(ScreenCapturer::isDamageCaptureSupported());
+    controlSocketCheckBox = new QCheckBox("Control socket");
+    controlSocketCheckBox->setToolTip(QString("Accept batched input from scripts on the local socket '%1'")
+                                          .arg(AutomationServer::defaultServerName()));
 
     startButton = new QPushButton("Start Capture");
     stopButton = new QPushButton("Stop Capture");
     fullscreenButton = new QPushButton("Go Fullscreen");
+    newViewButton = new QPushButton("New View");
+    editRegionsButton = new QPushButton("Regions");
+    editRegionsButton->setCheckable(true);
+    editRegionsButton->setToolTip("Drag on the view to add a region captured at its own rate");
+    clearRegionsButton = new QPushButton("Clear Regions");
     aboutButton = new QPushButton("About");
     statusLabel = new QLabel("Ready");
     fpsLabel = new QLabel("FPS: 0");
@@ -45,9 +79,17 @@ void MainWindow::setupUI()
     controlLayout->addWidget(screenSelector);
     controlLayout->addWidget(new QLabel("Target FPS:"));
     controlLayout->addWidget(fpsSpinBox);
+    controlLayout->addWidget(pixelModeSelector);
+    controlLayout->addWidget(captureOnChangeCheckBox);
+    controlLayout->addWidget(shareFramesCheckBox);
+    controlLayout->addWidget(grayscaleCheckBox);
+    controlLayout->addWidget(controlSocketCheckBox);
     controlLayout->addWidget(startButton);
     controlLayout->addWidget(stopButton);
     controlLayout->addWidget(fullscreenButton);
+    controlLayout->addWidget(newViewButton);
+    controlLayout->addWidget(editRegionsButton);
+    controlLayout->addWidget(clearRegionsButton);
     controlLayout->addWidget(fpsLabel);
     controlLayout->addWidget(statusLabel);
     controlLayout->addStretch();
@@ -58,7 +100,24 @@ void MainWindow::setupUI()
     controlWidget->setLayout(controlLayout);
     controlWidget->setFixedHeight(50);
 
+    historyCheckBox = new QCheckBox("Keep history");
+    historyCheckBox->setToolTip("Keep the last seconds of capture as compressed tiles to step back through");
+    historySlider = new QSlider(Qt::Horizontal);
+    historySlider->setRange(0, 0);
+    historySlider->setEnabled(false);
+    historySlider->setToolTip("Drag to step back through recent frames while capture continues");
+    liveButton = new QPushButton("Live");
+    liveButton->setEnabled(false);
+    historyLabel = new QLabel("History: off");
+
+    QHBoxLayout *historyLayout = new QHBoxLayout();
+    historyLayout->addWidget(historyCheckBox);
+    historyLayout->addWidget(historySlider, 1);
+    historyLayout->addWidget(liveButton);
+    historyLayout->addWidget(historyLabel);
+
     mainLayout->addWidget(controlWidget, 0);
+    mainLayout->addLayout(historyLayout, 0);
     mainLayout->addWidget(screenWidget, 1);
 
     stopButton->setEnabled(false);
@@ -69,7 +128,10 @@ void MainWindow::setupUI()
     startButton->setFixedWidth(100);
     stopButton->setFixedWidth(100);
      fullscreenButton->setFixedWidth(100);
+    newViewButton->setFixedWidth(100);
     statusLabel->setMinimumWidth(200);
+    liveButton->setFixedWidth(100);
+    historyLabel->setMinimumWidth(260);
 
     setWindowTitle("MultiDisplayHelper");
     resize(1000, 700);
@@ -77,8 +139,8 @@ void MainWindow::setupUI()
 
 void MainWindow::setupConnections()
 {
-    connect(screenCapturer, &ScreenCapturer::screenCaptured,
-            this, &MainWindow::onScreenCaptured);
+    connect(screenCapturer, &ScreenCapturer::frameCaptured,
+            this, &MainWindow::onFrameCaptured);
     connect(screenCapturer, &ScreenCapturer::fpsUpdated,
             this, &MainWindow::onFpsUpdated);
 
@@ -94,12 +156,54 @@ void MainWindow::setupConnections()
     connect(fpsSpinBox, QOverload<int>::of(&QSpinBox::valueChanged),
             this, &MainWindow::onFpsChanged);
 
+    connect(pixelModeSelector, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onPixelModeChanged);
+
+    connect(shareFramesCheckBox, &QCheckBox::toggled,
+            this, &MainWindow::onShareFramesToggled);
+
+    connect(captureOnChangeCheckBox, &QCheckBox::toggled,
+            this, &MainWindow::onCaptureOnChangeToggled);
+
+    connect(grayscaleCheckBox, &QCheckBox::toggled,
+            this, &MainWindow::onGrayscaleToggled);
+
+    connect(controlSocketCheckBox, &QCheckBox::toggled,
+            this, &MainWindow::onControlSocketToggled);
+
     connect(aboutButton, &QPushButton::clicked,
             this, &MainWindow::onAboutButton);
 
     connect(fullscreenButton, &QPushButton::clicked,
             this, &MainWindow::onFullscreenButton);
 
+    connect(newViewButton, &QPushButton::clicked,
+            this, &MainWindow::onNewViewButton);
+
+    connect(editRegionsButton, &QPushButton::toggled,
+            this, &MainWindow::onEditRegionsToggled);
+
+    connect(clearRegionsButton, &QPushButton::clicked,
+            this, &MainWindow::onClearRegions);
+
+    connect(screenWidget, &ScreenWidget::regionDrawn,
+            this, &MainWindow::onRegionDrawn);
+
+    connect(historyCheckBox, &QCheckBox::toggled,
+            this, &MainWindow::onHistoryToggled);
+
+    connect(historyWatcher, &QFutureWatcher<void>::finished,
+            this, &MainWindow::onHistoryAppended);
+
+    connect(historyFrameWatcher, &QFutureWatcher<HistoryFrame>::finished,
+            this, &MainWindow::onHistoryFrameReady);
+
+    connect(historySlider, &QSlider::valueChanged,
+            this, &MainWindow::onHistoryPositionChanged);
+
+    connect(liveButton, &QPushButton::clicked,
+            this, &MainWindow::onLiveButton);
+
 
     connect(screenWidget, &ScreenWidget::mouseClicked,
             this, &MainWindow::onMouseClicked);
@@ -137,18 +241,175 @@ void MainWindow::updateScreenList()
     }
 }
 
-void MainWindow::onScreenCaptured(const QPixmap &pixmap)
+void MainWindow::onFrameCaptured(const CapturedFrame &frame)
 {
-    screenWidget->setScreenImage(pixmap);
+    // Kept for the Live button; the pool only reuses a buffer two frames later.
+    latestFrame = frame;
+    if (showingLive) {
+        screenWidget->setScreenFrame(frame);
+    }
+    if (historyCheckBox->isChecked()) {
+        appendToHistory(frame);
+    }
 
     statusLabel->setText(QString("Capturing... %1x%2")
-                             .arg(pixmap.width())
-                             .arg(pixmap.height()));
+                             .arg(frame.image.width())
+                             .arg(frame.image.height()));
+}
+
+// Compressing a large frame takes milliseconds, so it happens on a worker. Frames arriving
+// meanwhile are folded into one whose dirty rectangles cover all of them.
+void MainWindow::appendToHistory(const CapturedFrame &frame)
+{
+    if (historyWatcher->isRunning()) {
+        QVector<QRect> dirtyRects = pendingHistoryFrame.dirtyRects;
+        if (!pendingHistoryFrame.isNull() && frame.image.size() == pendingHistoryFrame.image.size()) {
+            dirtyRects += frame.dirtyRects;
+        } else {
+            dirtyRects = frame.dirtyRects;
+        }
+        pendingHistoryFrame = frame;
+        pendingHistoryFrame.dirtyRects = dirtyRects;
+        return;
+    }
+
+    historyWatcher->setFuture(QtConcurrent::run([this, frame]() {
+        frameHistory.append(frame);
+    }));
+}
+
+void MainWindow::onHistoryAppended()
+{
+    // Read the bar before the next append starts.
+    updateHistoryBar();
+    if (!pendingHistoryFrame.isNull()) {
+        CapturedFrame frame = pendingHistoryFrame;
+        pendingHistoryFrame = CapturedFrame();
+        appendToHistory(frame);
+    }
+}
+
+void MainWindow::onHistoryToggled(bool checked)
+{
+    historySlider->setEnabled(checked);
+    if (checked) {
+        updateHistoryBar();
+        return;
+    }
+
+    historyWatcher->waitForFinished();
+    historyFrameWatcher->waitForFinished();
+    pendingHistoryFrame = CapturedFrame();
+    frameHistory.clear();
+    onLiveButton();
+}
+
+void MainWindow::updateHistoryBar()
+{
+    const int count = frameHistory.frameCount();
+    QSignalBlocker blocker(historySlider);
+    historySlider->setRange(0, qMax(0, count - 1));
+
+    int index = count - 1;
+    if (!showingLive) {
+        // Older frames keep dropping out of the history; stay on the frame being looked at.
+        index = frameHistory.indexOf(historySequence);
+        if (index < 0) {
+            showHistoryFrame(0);
+            return;
+        }
+    }
+    // While a frame is being rebuilt the slider stays where it was dragged to.
+    if (!historyFrameWanted) {
+        historySlider->setValue(index);
+    }
+
+    if (!historyCheckBox->isChecked()) {
+        historyLabel->setText("History: off");
+        return;
+    }
+    if (count == 0) {
+        historyLabel->setText("History: empty");
+        return;
+    }
+
+    const qint64 newestNs = frameHistory.timestampNs(count - 1);
+    const double spanSeconds = (newestNs - frameHistory.timestampNs(0)) / 1e9;
+    const double memoryMb = frameHistory.memoryUsage() / (1024.0 * 1024.0);
+    if (showingLive) {
+        historyLabel->setText(QString("Live, %1 s kept in %2 MB").arg(spanSeconds, 0, 'f', 1).arg(memoryMb, 0, 'f', 0));
+    } else {
+        historyLabel->setText(QString("-%1 s of %2 s, decoded in %3 ms")
+                                  .arg((newestNs - frameHistory.timestampNs(index)) / 1e9, 0, 'f', 2)
+                                  .arg(spanSeconds, 0, 'f', 1)
+                                  .arg(frameHistory.lastReconstructNs() / 1e6, 0, 'f', 1));
+    }
+}
+
+// Rebuilding a distant frame can take tens of milliseconds, so it happens on a worker. Only the
+// position picked last is rebuilt once the current one is done; the ones in between are dropped.
+void MainWindow::showHistoryFrame(int index)
+{
+    historyFrameWanted = true;
+    if (historyFrameWatcher->isRunning()) {
+        pendingHistoryIndex = index;
+        return;
+    }
+
+    historyFrameWatcher->setFuture(QtConcurrent::run([this, index]() {
+        HistoryFrame frame;
+        frame.image = frameHistory.frameAt(index, &frame.sequence);
+        return frame;
+    }));
+}
+
+void MainWindow::onHistoryFrameReady()
+{
+    if (pendingHistoryIndex >= 0) {
+        int index = pendingHistoryIndex;
+        pendingHistoryIndex = -1;
+        showHistoryFrame(index);
+        return;
+    }
+    if (!historyFrameWanted) return; // back to live meanwhile
+    historyFrameWanted = false;
+
+    HistoryFrame frame = historyFrameWatcher->result();
+    if (frame.image.isNull()) return;
+
+    showingLive = false;
+    historySequence = frame.sequence;
+    liveButton->setEnabled(true);
+    screenWidget->setScreenImage(frame.image);
+    updateHistoryBar();
+}
+
+void MainWindow::onHistoryPositionChanged(int index)
+{
+    showHistoryFrame(index);
+}
+
+void MainWindow::onLiveButton()
+{
+    showingLive = true;
+    historyFrameWanted = false;
+    pendingHistoryIndex = -1;
+    liveButton->setEnabled(false);
+
+    // Show the newest frame right away; with capture on change the next one may take a while.
+    if (!latestFrame.isNull()) {
+        screenWidget->setScreenFrame(latestFrame);
+    }
+    updateHistoryBar();
 }
 
 void MainWindow::onFpsUpdated(int fps)
 {
-    fpsLabel->setText(QString("FPS: %1").arg(fps));
+    if (screenCapturer->getCaptureRegions().isEmpty()) {
+        fpsLabel->setText(QString("FPS: %1").arg(fps));
+    } else {
+        fpsLabel->setText(QString("FPS: %1  Grab: %2%").arg(fps).arg(screenCapturer->getGrabAreaPercent(), 0, 'f', 1));
+    }
 }
 
 void MainWindow::onStartCapture()
@@ -194,6 +455,92 @@ void MainWindow::onFpsChanged(int fps)
     statusLabel->setText(QString("FPS set to: %1").arg(fps));
 }
 
+void MainWindow::onPixelModeChanged(int index)
+{
+    PixelModeConverter::Mode mode = PixelModeConverter::Mode(pixelModeSelector->itemData(index).toInt());
+    screenCapturer->setPixelMode(mode);
+    statusLabel->setText(QString("Pixel mode: %1 (%2 bits per pixel)")
+                             .arg(PixelModeConverter::modeName(mode))
+                             .arg(PixelModeConverter::bitsPerPixel(mode)));
+}
+
+void MainWindow::onShareFramesToggled(bool checked)
+{
+    screenCapturer->setFrameExportEnabled(checked);
+
+    if (checked) {
+        statusLabel->setText(QString("Sharing frames as: %1").arg(screenCapturer->frameExportKey()));
+    } else {
+        statusLabel->setText("Frame sharing stopped");
+    }
+}
+
+void MainWindow::onCaptureOnChangeToggled(bool checked)
+{
+    screenCapturer->setCaptureMode(checked ? ScreenCapturer::DamageCapture
+                                           : ScreenCapturer::TimerCapture);
+    statusLabel->setText(checked ? "Capturing on screen changes" : "Capturing on timer");
+}
+
+void MainWindow::onGrayscaleToggled(bool checked)
+{
+    FrameFilterPipeline *pipeline = screenCapturer->filterPipeline();
+
+    if (checked && !grayscaleFilter) {
+        grayscaleFilter = new GrayscaleFilter();
+        pipeline->addFilter(grayscaleFilter);
+    } else if (!checked && grayscaleFilter) {
+        pipeline->removeFilter(grayscaleFilter);
+        grayscaleFilter = nullptr;
+    }
+}
+
+void MainWindow::onControlSocketToggled(bool checked)
+{
+    if (!checked) {
+        automationServer->stop();
+        statusLabel->setText("Control socket closed");
+        return;
+    }
+
+    if (automationServer->start()) {
+        statusLabel->setText(QString("Control socket: %1").arg(automationServer->serverName()));
+    } else {
+        controlSocketCheckBox->setChecked(false);
+        statusLabel->setText("Failed to open control socket");
+    }
+}
+
+void MainWindow::onEditRegionsToggled(bool checked)
+{
+    screenWidget->setRegionEditMode(checked);
+    statusLabel->setText(checked ? "Drag on the view to add a capture region" : "Region editing finished");
+}
+
+void MainWindow::onRegionDrawn(const QRect &rect)
+{
+    bool ok = false;
+    int fps = QInputDialog::getInt(this, "Capture Region",
+                                   QString("Capture rate for %1x%2 at %3,%4:")
+                                       .arg(rect.width()).arg(rect.height()).arg(rect.x()).arg(rect.y()),
+                                   60, 1, 60, 1, &ok);
+    if (!ok) return;
+
+    QVector<CaptureRegion> regions = screenCapturer->getCaptureRegions();
+    regions.append(CaptureRegion{rect, fps});
+    screenCapturer->setCaptureRegions(regions);
+    screenWidget->setCaptureRegions(screenCapturer->getCaptureRegions());
+    statusLabel->setText(QString("%1 capture regions, rest of the screen at %2 FPS")
+                             .arg(regions.size()).arg(fpsSpinBox->value()));
+}
+
+void MainWindow::onClearRegions()
+{
+    screenCapturer->setCaptureRegions(QVector<CaptureRegion>());
+    screenWidget->setCaptureRegions(QVector<CaptureRegion>());
+    statusLabel->setText("Capture regions cleared");
+}
+
 void MainWindow::onMouseClicked(const QPoint &position, Qt::MouseButton button)
 {
     if (screenWidget->isCaptureActive()) {
@@ -243,6 +590,26 @@ void MainWindow::onFullscreenButton()
 
 }
 
+void MainWindow::onNewViewButton()
+{
+    ScreenWidget *view = new ScreenWidget(this);
+    view->setWindowFlags(Qt::Window);
+    view->setAttribute(Qt::WA_DeleteOnClose);
+    view->setWindowTitle(QString("MultiDisplayHelper - View %1").arg(++viewCount));
+    view->resize(800, 500);
+
+    connect(screenCapturer, &ScreenCapturer::frameCaptured, view,
+            [view](const CapturedFrame &frame) { view->setScreenFrame(frame); });
+
+    connect(view, &ScreenWidget::mouseClicked, this, &MainWindow::onMouseClicked);
+    connect(view, &ScreenWidget::mouseMoved, this, &MainWindow::onMouseMoved);
+    connect(view, &ScreenWidget::mousePressed, this, &MainWindow::onMousePressed);
+    connect(view, &ScreenWidget::mouseReleased, this, &MainWindow::onMouseReleased);
+    connect(view, &ScreenWidget::mouseWheel, this, &MainWindow::onMouseWheel);
+
+    view->show();
+}
+
 void MainWindow::onAboutButton()
 {
     QMessageBox::about(this, "About MultiDisplayHelper",
@@ -8,10 +8,15 @@
 #include <QPushButton>
 #include <QComboBox>
 #include <QSpinBox>
+#include <QCheckBox>
+#include <QSlider>
+#include <QFutureWatcher>
 
 #include "screen_capturer.h"
 #include "mouse_controller.h"
 #include "screen_widget.h"
+#include "automation_server.h"
+#include "frame_history.h"
 
 class MainWindow : public QMainWindow
 {
@@ -22,16 +27,30 @@ public:
     ~MainWindow();
 
 private slots:
-    void onScreenCaptured(const QPixmap &pixmap);
+    void onFrameCaptured(const CapturedFrame &frame);
     void onFpsUpdated(int fps);
 
     void onStartCapture();
     void onStopCapture();
     void onFullscreenButton();
+    void onNewViewButton();
     void onAboutButton();
 
     void onScreenSelected(int index);
     void onFpsChanged(int fps);
+    void onPixelModeChanged(int index);
+    void onShareFramesToggled(bool checked);
+    void onGrayscaleToggled(bool checked);
+    void onCaptureOnChangeToggled(bool checked);
+    void onControlSocketToggled(bool checked);
+    void onEditRegionsToggled(bool checked);
+    void onRegionDrawn(const QRect &rect);
+    void onClearRegions();
+    void onHistoryToggled(bool checked);
+    void onHistoryAppended();
+    void onHistoryFrameReady();
+    void onHistoryPositionChanged(int index);
+    void onLiveButton();
 
     void onMouseClicked(const QPoint &position, Qt::MouseButton button);
     void onMouseMoved(const QPoint &position);
@@ -45,23 +64,58 @@ private:
     void setupUI();
     void setupConnections();
     void updateScreenList();
+    void updateHistoryBar();
+    void showHistoryFrame(int index);
+    void appendToHistory(const CapturedFrame &frame);
 
     ScreenCapturer *screenCapturer;
     MouseController *mouseController;
     ScreenWidget *screenWidget;
+    AutomationServer *automationServer;
+    RegionWaiter *regionWaiter;
 
     QComboBox *screenSelector;
     QSpinBox *fpsSpinBox;
+    QComboBox *pixelModeSelector;
+    QCheckBox *shareFramesCheckBox;
+    QCheckBox *grayscaleCheckBox;
+    QCheckBox *captureOnChangeCheckBox;
+    QCheckBox *controlSocketCheckBox;
+    GrayscaleFilter *grayscaleFilter = nullptr;
+
+    struct HistoryFrame
+    {
+        QImage image;
+        quint64 sequence = 0;
+    };
+
+    FrameHistory frameHistory;
+    QFutureWatcher<void> *historyWatcher;
+    CapturedFrame pendingHistoryFrame; // arrived while the previous frame was still being appended
+    QFutureWatcher<HistoryFrame> *historyFrameWatcher;
+    int pendingHistoryIndex = -1;      // slider position picked while another frame was being rebuilt
+    bool historyFrameWanted = false;
+    CapturedFrame latestFrame;
+    QCheckBox *historyCheckBox;
+    QSlider *historySlider;
+    QPushButton *liveButton;
+    QLabel *historyLabel;
+    bool showingLive = true;
+    quint64 historySequence = 0;
 
     QPushButton *startButton;
     QPushButton *stopButton;
     QPushButton *fullscreenButton;
+    QPushButton *newViewButton;
+    QPushButton *editRegionsButton;
+    QPushButton *clearRegionsButton;
     QPushButton *aboutButton;
 
     QLabel *statusLabel;
     QLabel *fpsLabel;
 
     bool isFullscreen = false;
+    int viewCount = 0;
 };
 
 #endif
@@ -0,0 +1,270 @@
+#include "pixel_mode_converter.h"
+#include "simd_support.h"
+
+#include <QElapsedTimer>
+
+namespace PixelKernels {
+
+void rgb32ToRgb565(const quint32 *src, quint16 *dst, int count)
+{
+    int i = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i redMask = _mm_set1_epi32(0xf800);
+    const __m128i greenMask = _mm_set1_epi32(0x07e0);
+    const __m128i blueMask = _mm_set1_epi32(0x001f);
+    const __m128i bias32 = _mm_set1_epi32(0x8000);
+    const __m128i bias16 = _mm_set1_epi16(short(0x8000));
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i out[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + half * 4));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(p, 8), redMask);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 5), greenMask);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(p, 3), blueMask);
+            out[half] = _mm_sub_epi32(_mm_or_si128(_mm_or_si128(r, g), b), bias32);
+        }
+        __m128i packed = _mm_add_epi16(_mm_packs_epi32(out[0], out[1]), bias16);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+#endif
+    for (; i < count; ++i) {
+        quint32 p = src[i];
+        dst[i] = quint16(((p >> 8) & 0xf800) | ((p >> 5) & 0x07e0) | ((p >> 3) & 0x001f));
+    }
+}
+
+void rgb32ToGray8(const quint32 *src, uchar *dst, int count)
+{
+    int i = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i byteMask = _mm_set1_epi32(0xff);
+    const __m128i redWeight = _mm_set1_epi32(77);
+    const __m128i greenWeight = _mm_set1_epi32(150);
+    const __m128i blueWeight = _mm_set1_epi32(29);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i gray[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + half * 4));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), byteMask);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 8), byteMask);
+            __m128i b = _mm_and_si128(p, byteMask);
+            __m128i sum = _mm_add_epi32(_mm_mullo_epi16(r, redWeight), _mm_mullo_epi16(g, greenWeight));
+            sum = _mm_add_epi32(sum, _mm_mullo_epi16(b, blueWeight));
+            gray[half] = _mm_srli_epi32(sum, 8);
+        }
+        __m128i words = _mm_packs_epi32(gray[0], gray[1]);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; i < count; ++i) {
+        quint32 p = src[i];
+        dst[i] = uchar((((p >> 16) & 0xff) * 77 + ((p >> 8) & 0xff) * 150 + (p & 0xff) * 29) >> 8);
+    }
+}
+
+void rgb32ToRgb332(const quint32 *src, uchar *dst, int count)
+{
+    int i = 0;
+#ifdef MDH_HAVE_SSE2
+    const __m128i redMask = _mm_set1_epi32(0xe0);
+    const __m128i greenMask = _mm_set1_epi32(0x1c);
+    const __m128i blueMask = _mm_set1_epi32(0x03);
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i index[2];
+        for (int half = 0; half < 2; ++half) {
+            __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i + half * 4));
+            __m128i r = _mm_and_si128(_mm_srli_epi32(p, 16), redMask);
+            __m128i g = _mm_and_si128(_mm_srli_epi32(p, 11), greenMask);
+            __m128i b = _mm_and_si128(_mm_srli_epi32(p, 6), blueMask);
+            index[half] = _mm_or_si128(_mm_or_si128(r, g), b);
+        }
+        __m128i words = _mm_packs_epi32(index[0], index[1]);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(dst + i), _mm_packus_epi16(words, words));
+    }
+#endif
+    for (; i < count; ++i) {
+        quint32 p = src[i];
+        dst[i] = uchar(((p >> 16) & 0xe0) | ((p >> 11) & 0x1c) | ((p >> 6) & 0x03));
+    }
+}
+
+}
+
+PixelModeConverter::PixelModeConverter()
+    : mode(Rgb32),
+    invalidated(true),
+    frameCount(0),
+    totalNs(0),
+    totalOutputBytes(0),
+    totalFullDepthBytes(0)
+{
+    palette.reserve(256);
+    for (int i = 0; i < 256; ++i) {
+        palette.append(qRgb(((i >> 5) & 7) * 255 / 7, ((i >> 2) & 7) * 255 / 7, (i & 3) * 255 / 3));
+    }
+}
+
+QString PixelModeConverter::modeName(Mode mode)
+{
+    switch (mode) {
+    case Rgb565:
+        return "RGB565";
+    case Grayscale8:
+        return "Grayscale";
+    case Palette8:
+        return "8-bit palette";
+    case Rgb32:
+    default:
+        return "32-bit";
+    }
+}
+
+QImage::Format PixelModeConverter::formatFor(Mode mode)
+{
+    switch (mode) {
+    case Rgb565:
+        return QImage::Format_RGB16;
+    case Grayscale8:
+        return QImage::Format_Grayscale8;
+    case Palette8:
+        return QImage::Format_Indexed8;
+    case Rgb32:
+    default:
+        return QImage::Format_RGB32;
+    }
+}
+
+int PixelModeConverter::bitsPerPixel(Mode mode)
+{
+    switch (mode) {
+    case Rgb565:
+        return 16;
+    case Grayscale8:
+    case Palette8:
+        return 8;
+    case Rgb32:
+    default:
+        return 32;
+    }
+}
+
+void PixelModeConverter::setMode(Mode newMode)
+{
+    if (newMode == mode) return;
+
+    mode = newMode;
+    invalidate();
+}
+
+PixelModeConverter::Mode PixelModeConverter::getMode() const
+{
+    return mode;
+}
+
+void PixelModeConverter::invalidate()
+{
+    invalidated = true;
+    lastOutput = QImage();
+    pool.reset();
+}
+
+qint64 PixelModeConverter::convertedFrames() const
+{
+    return frameCount;
+}
+
+qint64 PixelModeConverter::conversionNs() const
+{
+    return totalNs;
+}
+
+qint64 PixelModeConverter::outputBytes() const
+{
+    return totalOutputBytes;
+}
+
+qint64 PixelModeConverter::fullDepthBytes() const
+{
+    return totalFullDepthBytes;
+}
+
+void PixelModeConverter::resetStats()
+{
+    frameCount = 0;
+    totalNs = 0;
+    totalOutputBytes = 0;
+    totalFullDepthBytes = 0;
+}
+
+void PixelModeConverter::convertRect(const QImage &source, QImage &target, const QRect &rect) const
+{
+    QRect area = rect.intersected(source.rect()).intersected(target.rect());
+
+    for (int y = area.top(); y <= area.bottom(); ++y) {
+        const quint32 *src = reinterpret_cast<const quint32 *>(source.constScanLine(y)) + area.x();
+
+        switch (mode) {
+        case Rgb565:
+            PixelKernels::rgb32ToRgb565(src, reinterpret_cast<quint16 *>(target.scanLine(y)) + area.x(), area.width());
+            break;
+        case Grayscale8:
+            PixelKernels::rgb32ToGray8(src, target.scanLine(y) + area.x(), area.width());
+            break;
+        case Palette8:
+            PixelKernels::rgb32ToRgb332(src, target.scanLine(y) + area.x(), area.width());
+            break;
+        case Rgb32:
+            break;
+        }
+    }
+}
+
+void PixelModeConverter::process(CapturedFrame &frame)
+{
+    if (mode == Rgb32 || frame.image.isNull()) return;
+
+    QImage source = frame.image;
+    if (source.depth() != 32) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    bool fullRefresh = invalidated || !pool.isValid() || pool.size() != source.size();
+    if (!fullRefresh && frame.dirtyRects.isEmpty()) {
+        frame.image = lastOutput;
+    } else if (fullRefresh) {
+        QImage converted(source.size(), formatFor(mode));
+        if (mode == Palette8) {
+            converted.setColorTable(palette);
+        }
+        convertRect(source, converted, source.rect());
+
+        QImage &buffer = pool.adopt(std::move(converted), QRegion(source.rect()));
+        frame.image = buffer;
+        frame.dirtyRects = QVector<QRect>() << source.rect();
+        invalidated = false;
+    } else {
+        QRegion dirty;
+        for (const QRect &rect : frame.dirtyRects) {
+            dirty += rect;
+        }
+
+        QImage &buffer = pool.beginFrame(dirty);
+        for (const QRect &rect : dirty) {
+            convertRect(source, buffer, rect);
+        }
+        frame.image = buffer;
+    }
+
+    lastOutput = frame.image;
+
+    frameCount++;
+    totalNs += timer.nsecsElapsed();
+    totalOutputBytes += qint64(frame.image.bytesPerLine()) * frame.image.height();
+    totalFullDepthBytes += qint64(frame.image.width()) * frame.image.height() * 4;
+}
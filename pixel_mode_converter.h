@@ -0,0 +1,62 @@
+#ifndef PIXEL_MODE_CONVERTER_H
+#define PIXEL_MODE_CONVERTER_H
+
+#include <QImage>
+#include <QVector>
+#include <QString>
+
+#include "captured_frame.h"
+#include "frame_pool.h"
+
+class PixelModeConverter
+{
+public:
+    enum Mode {
+        Rgb32,
+        Rgb565,
+        Grayscale8,
+        Palette8
+    };
+
+    PixelModeConverter();
+
+    static QString modeName(Mode mode);
+    static QImage::Format formatFor(Mode mode);
+    static int bitsPerPixel(Mode mode);
+
+    void setMode(Mode mode);
+    Mode getMode() const;
+    void invalidate();
+
+    void process(CapturedFrame &frame);
+
+    qint64 convertedFrames() const;
+    qint64 conversionNs() const;
+    qint64 outputBytes() const;
+    qint64 fullDepthBytes() const;
+    void resetStats();
+
+private:
+    void convertRect(const QImage &source, QImage &target, const QRect &rect) const;
+
+    Mode mode;
+    FramePool pool;
+    QImage lastOutput;
+    QVector<QRgb> palette;
+    bool invalidated;
+
+    qint64 frameCount;
+    qint64 totalNs;
+    qint64 totalOutputBytes;
+    qint64 totalFullDepthBytes;
+};
+
+namespace PixelKernels {
+
+void rgb32ToRgb565(const quint32 *src, quint16 *dst, int count);
+void rgb32ToGray8(const quint32 *src, uchar *dst, int count);
+void rgb32ToRgb332(const quint32 *src, uchar *dst, int count);
+
+}
+
+#endif
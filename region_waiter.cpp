@@ -0,0 +1,267 @@
+#include "region_waiter.h"
+#include <QDebug>
+
+#include "dirty_tile_tracker.h"
+
+RegionWaiter::RegionWaiter(ScreenCapturer *capturer, QObject *parent)
+    : QObject(parent),
+    capturer(capturer),
+    nextId(1),
+    deadlineTimer(new QTimer(this)),
+    baselinePending(false),
+    tileColumns(0),
+    tileRows(0)
+{
+    qRegisterMetaType<RegionWaiter::Result>();
+
+    deadlineTimer->setSingleShot(true);
+    deadlineTimer->setTimerType(Qt::PreciseTimer);
+    connect(deadlineTimer, &QTimer::timeout, this, &RegionWaiter::onDeadline);
+    connect(capturer, &ScreenCapturer::frameCaptured, this, &RegionWaiter::onFrameCaptured);
+}
+
+RegionWaiter::~RegionWaiter()
+{
+    cancelAll();
+}
+
+QString RegionWaiter::resultName(Result result)
+{
+    switch (result) {
+    case Changed:
+        return "changed";
+    case Settled:
+        return "settled";
+    case TimedOut:
+        return "timeout";
+    case Cancelled:
+        return "cancelled";
+    }
+    return QString();
+}
+
+int RegionWaiter::waitForChange(const QRect &region, int timeoutMs)
+{
+    return waitForChange(region, timeoutMs, Callback());
+}
+
+int RegionWaiter::waitForSettle(const QRect &region, int quietMs, int timeoutMs)
+{
+    return waitForSettle(region, quietMs, timeoutMs, Callback());
+}
+
+int RegionWaiter::waitForChange(const QRect &region, int timeoutMs, Callback callback)
+{
+    Wait wait;
+    wait.region = region;
+    wait.timeoutNs = timeoutMs >= 0 ? qint64(timeoutMs) * 1000000 : -1;
+    wait.callback = std::move(callback);
+    return addWait(wait);
+}
+
+int RegionWaiter::waitForSettle(const QRect &region, int quietMs, int timeoutMs, Callback callback)
+{
+    Wait wait;
+    wait.region = region;
+    wait.settle = true;
+    wait.quietNs = qint64(qMax(0, quietMs)) * 1000000;
+    wait.timeoutNs = timeoutMs >= 0 ? qint64(timeoutMs) * 1000000 : -1;
+    wait.callback = std::move(callback);
+    return addWait(wait);
+}
+
+int RegionWaiter::pendingWaits() const
+{
+    return waits.size();
+}
+
+int RegionWaiter::addWait(const Wait &wait)
+{
+    if (waits.isEmpty() && capturer) {
+        // Switching tracking on seeds it with the last frame captured, so the next frame already
+        // reports what changed since now. Only without any frame yet does the first one become the baseline.
+        capturer->setChangeTrackingRequired(true);
+        baselinePending = !capturer->hasChangeBaseline();
+    }
+
+    int id = nextId++;
+    Wait &added = waits[id];
+    added = wait;
+    added.startNs = CapturedFrame::currentTimestampNs();
+    added.lastChangeNs = added.startNs;
+
+    scheduleDeadline();
+    return id;
+}
+
+void RegionWaiter::cancel(int id)
+{
+    if (waits.contains(id)) {
+        finish(id, Cancelled, CapturedFrame::currentTimestampNs());
+    }
+}
+
+void RegionWaiter::cancelAll()
+{
+    const QList<int> ids = waits.keys();
+    for (int id : ids) {
+        cancel(id);
+    }
+}
+
+void RegionWaiter::finish(int id, Result result, qint64 nowNs)
+{
+    Wait wait = waits.take(id);
+
+    if (waits.isEmpty()) {
+        deadlineTimer->stop();
+        if (capturer) {
+            capturer->setChangeTrackingRequired(false);
+        }
+    }
+
+    const qint64 elapsedMs = (nowNs - wait.startNs) / 1000000;
+    emit waitFinished(id, result, elapsedMs);
+    if (wait.callback) {
+        wait.callback(result, elapsedMs);
+    }
+}
+
+void RegionWaiter::onFrameCaptured(const CapturedFrame &frame)
+{
+    if (waits.isEmpty()) return;
+
+    if (baselinePending) {
+        baselinePending = false;
+        checkDeadlines(frame.timestampNs, false);
+        return;
+    }
+
+    updateChangeMap(frame);
+
+    QList<int> changed;
+    for (auto it = waits.begin(); it != waits.end(); ++it) {
+        Wait &wait = it.value();
+        if (frame.timestampNs < wait.startNs || !regionChanged(wait.region)) continue;
+
+        if (wait.settle) {
+            wait.lastChangeNs = frame.timestampNs;
+        } else {
+            changed.append(it.key());
+        }
+    }
+
+    for (int id : changed) {
+        if (waits.contains(id)) {
+            finish(id, Changed, frame.timestampNs);
+        }
+    }
+
+    checkDeadlines(frame.timestampNs, true);
+}
+
+void RegionWaiter::onDeadline()
+{
+    checkDeadlines(CapturedFrame::currentTimestampNs(), false);
+}
+
+void RegionWaiter::updateChangeMap(const CapturedFrame &frame)
+{
+    const int tile = DirtyTileTracker::TileSize;
+
+    imageSize = frame.image.size();
+    imageOrigin = frame.origin;
+    tileColumns = (imageSize.width() + tile - 1) / tile;
+    tileRows = (imageSize.height() + tile - 1) / tile;
+
+    // Summed-area table over changed tiles, so every waiter is answered with four lookups.
+    const int stride = tileColumns + 1;
+    changedSums.fill(0, stride * (tileRows + 1));
+
+    for (const QRect &dirty : frame.dirtyRects) {
+        QRect rect = dirty.intersected(frame.image.rect());
+        if (rect.isEmpty()) continue;
+
+        for (int row = rect.top() / tile; row <= rect.bottom() / tile; ++row) {
+            for (int column = rect.left() / tile; column <= rect.right() / tile; ++column) {
+                changedSums[(row + 1) * stride + column + 1] = 1;
+            }
+        }
+    }
+
+    for (int row = 1; row <= tileRows; ++row) {
+        int rowSum = 0;
+        for (int column = 1; column <= tileColumns; ++column) {
+            rowSum += changedSums[row * stride + column];
+            changedSums[row * stride + column] = changedSums[(row - 1) * stride + column] + rowSum;
+        }
+    }
+}
+
+bool RegionWaiter::regionChanged(const QRect &region) const
+{
+    QRect rect = region.translated(-imageOrigin).intersected(QRect(QPoint(0, 0), imageSize));
+    if (rect.isEmpty()) return false;
+
+    const int tile = DirtyTileTracker::TileSize;
+    const int stride = tileColumns + 1;
+    const int left = rect.left() / tile;
+    const int top = rect.top() / tile;
+    const int right = rect.right() / tile + 1;
+    const int bottom = rect.bottom() / tile + 1;
+
+    return changedSums[bottom * stride + right] - changedSums[top * stride + right]
+           - changedSums[bottom * stride + left] + changedSums[top * stride + left] > 0;
+}
+
+void RegionWaiter::checkDeadlines(qint64 nowNs, bool frameArrived)
+{
+    // Without a new frame, quiet time only counts when frames are driven by X Damage:
+    // then no frame means nothing changed. A polling capture has to look first.
+    bool quietWithoutFrames = capturer && capturer->isCapturing()
+                              && capturer->getCaptureMode() == ScreenCapturer::DamageCapture;
+
+    QList<QPair<int, Result>> finished;
+    for (auto it = waits.constBegin(); it != waits.constEnd(); ++it) {
+        const Wait &wait = it.value();
+        if (wait.settle && (frameArrived || quietWithoutFrames) && nowNs - wait.lastChangeNs >= wait.quietNs) {
+            finished.append(qMakePair(it.key(), Settled));
+        } else if (wait.timeoutNs >= 0 && nowNs - wait.startNs >= wait.timeoutNs) {
+            finished.append(qMakePair(it.key(), TimedOut));
+        }
+    }
+
+    for (const auto &entry : finished) {
+        if (waits.contains(entry.first)) {
+            finish(entry.first, entry.second, nowNs);
+        }
+    }
+
+    scheduleDeadline();
+}
+
+void RegionWaiter::scheduleDeadline()
+{
+    bool quietWithoutFrames = capturer && capturer->isCapturing()
+                              && capturer->getCaptureMode() == ScreenCapturer::DamageCapture;
+
+    qint64 deadlineNs = -1;
+    for (const Wait &wait : waits) {
+        if (wait.timeoutNs >= 0) {
+            qint64 due = wait.startNs + wait.timeoutNs;
+            deadlineNs = deadlineNs < 0 ? due : qMin(deadlineNs, due);
+        }
+        if (wait.settle && quietWithoutFrames) {
+            qint64 due = wait.lastChangeNs + wait.quietNs;
+            deadlineNs = deadlineNs < 0 ? due : qMin(deadlineNs, due);
+        }
+    }
+
+    if (deadlineNs < 0) {
+        deadlineTimer->stop();
+        return;
+    }
+
+    qint64 remainingNs = deadlineNs - CapturedFrame::currentTimestampNs();
+    deadlineTimer->start(int(qMax<qint64>(0, (remainingNs + 999999) / 1000000)));
+}
@@ -0,0 +1,89 @@
+#ifndef REGION_WAITER_H
+#define REGION_WAITER_H
+
+#include <QObject>
+#include <QRect>
+#include <QMap>
+#include <QVector>
+#include <QTimer>
+#include <QPointer>
+
+#include <functional>
+
+#include "captured_frame.h"
+#include "screen_capturer.h"
+
+class RegionWaiter : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Result {
+        Changed,
+        Settled,
+        TimedOut,
+        Cancelled
+    };
+    Q_ENUM(Result)
+
+    using Callback = std::function<void(RegionWaiter::Result result, qint64 elapsedMs)>;
+
+    explicit RegionWaiter(ScreenCapturer *capturer, QObject *parent = nullptr);
+    ~RegionWaiter();
+
+    static QString resultName(Result result);
+
+    // Rectangles are in screen-local captured pixels, the same coordinates the views use, also
+    // when the frames are cropped. MouseController and the control socket work in logical
+    // coordinates; multiply those by CapturedFrame::devicePixelRatio. A negative timeout waits forever.
+    int waitForChange(const QRect &region, int timeoutMs = -1);
+    int waitForSettle(const QRect &region, int quietMs, int timeoutMs = -1);
+    void cancel(int id);
+    void cancelAll();
+
+    // The callback runs once, when the wait finishes, right after waitFinished is emitted.
+    int waitForChange(const QRect &region, int timeoutMs, Callback callback);
+    int waitForSettle(const QRect &region, int quietMs, int timeoutMs, Callback callback);
+
+    int pendingWaits() const;
+
+signals:
+    void waitFinished(int id, RegionWaiter::Result result, qint64 elapsedMs);
+
+private slots:
+    void onFrameCaptured(const CapturedFrame &frame);
+    void onDeadline();
+
+private:
+    struct Wait
+    {
+        QRect region;
+        bool settle = false;
+        qint64 quietNs = 0;
+        qint64 startNs = 0;
+        qint64 lastChangeNs = 0;
+        qint64 timeoutNs = -1;
+        Callback callback;
+    };
+
+    int addWait(const Wait &wait);
+    void finish(int id, Result result, qint64 nowNs);
+    void updateChangeMap(const CapturedFrame &frame);
+    bool regionChanged(const QRect &region) const;
+    void checkDeadlines(qint64 nowNs, bool frameArrived);
+    void scheduleDeadline();
+
+    QPointer<ScreenCapturer> capturer;
+    QMap<int, Wait> waits;
+    int nextId;
+    QTimer *deadlineTimer;
+    bool baselinePending;
+
+    QSize imageSize;
+    QPoint imageOrigin;
+    int tileColumns;
+    int tileRows;
+    QVector<int> changedSums;
+};
+
+#endif
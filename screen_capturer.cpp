@@ -1,6 +1,70 @@
 #include "screen_capturer.h"
 #include <QDebug>
 
+#include <cstring>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <ctime>
+#endif
+
+namespace {
+
+// CPU time of the whole process, so a pixel mode can be judged by what capture costs end to end.
+qint64 processCpuTimeNs()
+{
+#ifdef Q_OS_WIN
+    FILETIME creation, exit, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user)) return 0;
+    auto ticks = [](const FILETIME &time) { return (qint64(time.dwHighDateTime) << 32) | time.dwLowDateTime; };
+    return (ticks(kernel) + ticks(user)) * 100;
+#else
+    timespec time;
+    if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time) != 0) return 0;
+    return qint64(time.tv_sec) * 1000000000 + time.tv_nsec;
+#endif
+}
+
+// Rows of current that differ from previous, as one band; a size or format change marks it all.
+QRect changedRowSpan(const QImage &previous, const QImage &current)
+{
+    if (previous.size() != current.size() || previous.format() != current.format()) {
+        return current.rect();
+    }
+
+    const size_t rowBytes = size_t(current.width()) * current.depth() / 8;
+    int first = -1;
+    int last = -1;
+    for (int y = 0; y < current.height(); ++y) {
+        if (std::memcmp(previous.constScanLine(y), current.constScanLine(y), rowBytes) != 0) {
+            if (first < 0) first = y;
+            last = y;
+        }
+    }
+    return first < 0 ? QRect() : QRect(0, first, current.width(), last - first + 1);
+}
+
+// Room for a 32-bit frame of the largest screen, so the shared segment never has to grow.
+quint64 largestScreenFrameBytes()
+{
+    quint64 largest = 0;
+    for (QScreen *screen : QGuiApplication::screens()) {
+        QSize nativeSize = screen->geometry().size() * screen->devicePixelRatio();
+        largest = qMax(largest, quint64(nativeSize.width()) * quint64(nativeSize.height()) * 4);
+    }
+    return largest;
+}
+
+// Keeps the cadence when a wake-up is a little late, restarts it when whole intervals were missed.
+qint64 nextDeadline(qint64 deadline, qint64 intervalNs, qint64 nowNs)
+{
+    qint64 next = deadline + intervalNs;
+    return next > nowNs ? next : nowNs + intervalNs;
+}
+
+}
+
 ScreenCapturer::ScreenCapturer(QObject *parent)
     : QObject(parent),
     targetScreen(nullptr),
@@ -8,17 +72,40 @@ ScreenCapturer::ScreenCapturer(QObject *parent)
     targetFps(45),
     currentFps(0),
     frameCount(0),
-    lastFpsUpdate(0)
+    lastFpsUpdate(0),
+    cpuLogStartNs(0),
+    cpuLogStartMs(0),
+    frameExporter(nullptr),
+    changeTrackingRequired(false),
+    frameSequence(0),
+    captureMode(TimerCapture),
+    damageWatcher(new XDamageWatcher(this)),
+    damageTimer(new QTimer(this)),
+    lastGrabTime(0),
+    fullFrameDeadline(0),
+    grabbedPixels(0),
+    grabbedPixelsPerSecond(0.0),
+    grabAreaPercent(100.0)
 {
+    qRegisterMetaType<CapturedFrame>();
+
     captureTimer->setTimerType(Qt::PreciseTimer);
     connect(captureTimer, &QTimer::timeout, this, &ScreenCapturer::onCaptureTimeout);
+
+    damageTimer->setTimerType(Qt::PreciseTimer);
+    damageTimer->setSingleShot(true);
+    connect(damageTimer, &QTimer::timeout, this, &ScreenCapturer::onDamageCaptureTimeout);
+    connect(damageWatcher, &XDamageWatcher::damaged, this, &ScreenCapturer::onScreenDamaged);
+
     frameTimer.start();
     lastFpsUpdate = frameTimer.elapsed();
+    grabStatsTimer.start();
 }
 
 ScreenCapturer::~ScreenCapturer()
 {
     stopCapture();
+    delete frameExporter;
 }
 
 bool ScreenCapturer::initialize(int screenIndex)
@@ -26,7 +113,15 @@ bool ScreenCapturer::initialize(int screenIndex)
     QList<QScreen*> screens = QGuiApplication::screens();
 
     if (screenIndex >= 0 && screenIndex < screens.size()) {
+        if (targetScreen) {
+            disconnect(targetScreen, &QScreen::geometryChanged, this, &ScreenCapturer::onScreenGeometryChanged);
+        }
         targetScreen = screens[screenIndex];
+        connect(targetScreen, &QScreen::geometryChanged, this, &ScreenCapturer::onScreenGeometryChanged);
+        updateNativeScreenRect();
+        dirtyTracker.reset();
+        filters.invalidate();
+        pixelConverter.invalidate();
         qDebug() << "Screen capturer initialized for screen" << screenIndex
                  << "with geometry:" << targetScreen->geometry();
         return true;
@@ -52,6 +147,162 @@ int ScreenCapturer::getCurrentFps() const
     return currentFps;
 }
 
+void ScreenCapturer::setCaptureRegions(const QVector<CaptureRegion> &regions)
+{
+    captureRegions.clear();
+    for (CaptureRegion region : regions) {
+        region.rect = region.rect.normalized();
+        region.fps = qBound(1, region.fps, 60);
+        if (!region.rect.isEmpty()) {
+            captureRegions.append(region);
+        }
+    }
+    regionDeadlines.fill(0, captureRegions.size());
+    regionImages = QVector<QImage>(captureRegions.size());
+
+    qDebug() << "Capture regions set:" << captureRegions.size();
+
+    if (captureTimer->isActive()) {
+        stopCapture();
+        startCapture();
+    }
+}
+
+QVector<CaptureRegion> ScreenCapturer::getCaptureRegions() const
+{
+    return captureRegions;
+}
+
+double ScreenCapturer::getGrabAreaPercent() const
+{
+    return grabAreaPercent;
+}
+
+qreal ScreenCapturer::getDevicePixelRatio() const
+{
+    return targetScreen ? targetScreen->devicePixelRatio() : 1.0;
+}
+
+void ScreenCapturer::setCaptureMode(CaptureMode mode)
+{
+    if (mode == captureMode) return;
+
+    bool wasCapturing = isCapturing();
+    if (wasCapturing) {
+        stopCapture();
+    }
+
+    captureMode = mode;
+
+    if (wasCapturing) {
+        startCapture();
+    }
+}
+
+ScreenCapturer::CaptureMode ScreenCapturer::getCaptureMode() const
+{
+    return captureMode;
+}
+
+bool ScreenCapturer::isCapturing() const
+{
+    return captureTimer->isActive() || damageWatcher->isActive();
+}
+
+bool ScreenCapturer::isDamageCaptureSupported()
+{
+    return XDamageWatcher::isSupported();
+}
+
+// Asks the X server, so it is only called when capture starts or the screen changes.
+void ScreenCapturer::updateNativeScreenRect()
+{
+    nativeScreenRect = XDamageWatcher::outputGeometry(targetScreen->name());
+    if (!nativeScreenRect.isNull()) return;
+
+    // Without XRandR, assume one scale factor for the whole desktop.
+    QRect geometry = targetScreen->geometry();
+    qreal ratio = targetScreen->devicePixelRatio();
+    nativeScreenRect = QRect(QPoint(qRound(geometry.x() * ratio), qRound(geometry.y() * ratio)),
+                             geometry.size() * ratio);
+}
+
+void ScreenCapturer::onScreenGeometryChanged()
+{
+    if (damageWatcher->isActive()) {
+        // The watcher covers the old rectangle; starting again looks up the new one.
+        stopCapture();
+        startCapture();
+        return;
+    }
+    updateNativeScreenRect();
+}
+
+void ScreenCapturer::setFrameExportEnabled(bool enabled)
+{
+    if (enabled == isFrameExportEnabled()) return;
+
+    if (enabled) {
+        frameExporter = new FrameShmWriter();
+        frameExporter->setMinimumFrameBytes(largestScreenFrameBytes());
+        dirtyTracker.reset();
+        qDebug() << "Frame export enabled with key:" << frameExporter->key();
+    } else {
+        delete frameExporter;
+        frameExporter = nullptr;
+        qDebug() << "Frame export disabled";
+    }
+}
+
+bool ScreenCapturer::isFrameExportEnabled() const
+{
+    return frameExporter != nullptr;
+}
+
+QString ScreenCapturer::frameExportKey() const
+{
+    return frameExporter ? frameExporter->key() : QString();
+}
+
+FrameFilterPipeline *ScreenCapturer::filterPipeline()
+{
+    return &filters;
+}
+
+void ScreenCapturer::setPixelMode(PixelModeConverter::Mode mode)
+{
+    pixelConverter.setMode(mode);
+    pixelConverter.resetStats();
+    qDebug() << "Pixel mode set to:" << PixelModeConverter::modeName(mode);
+}
+
+PixelModeConverter::Mode ScreenCapturer::getPixelMode() const
+{
+    return pixelConverter.getMode();
+}
+
+void ScreenCapturer::setChangeTrackingRequired(bool required)
+{
+    bool wasNeeded = isChangeTrackingNeeded();
+    changeTrackingRequired = required;
+
+    // Start from the last frame instead of reporting the whole screen on the next one.
+    if (!wasNeeded && isChangeTrackingNeeded() && !untrackedFrame.isNull()) {
+        dirtyTracker.update(untrackedFrame);
+    }
+    untrackedFrame = QImage();
+}
+
+bool ScreenCapturer::hasChangeBaseline() const
+{
+    return isCapturing() && (dirtyTracker.columns() > 0 || captureMode == DamageCapture || !captureRegions.isEmpty());
+}
+
+bool ScreenCapturer::isChangeTrackingNeeded() const
+{
+    return changeTrackingRequired || frameExporter || !filters.isEmpty() || pixelConverter.getMode() != PixelModeConverter::Rgb32;
+}
+
 QPixmap ScreenCapturer::captureScreen()
 {
     if (!targetScreen) return QPixmap();
@@ -62,11 +313,41 @@ QPixmap ScreenCapturer::captureScreen()
 void ScreenCapturer::startCapture()
 {
     if (targetScreen) {
-        int intervalMs = 1000 / targetFps;
-        captureTimer->start(intervalMs);
         frameTimer.restart();
         frameCount = 0;
         lastFpsUpdate = frameTimer.elapsed();
+        cpuLogStartNs = processCpuTimeNs();
+        cpuLogStartMs = lastFpsUpdate;
+        updateNativeScreenRect();
+
+        if (captureMode == DamageCapture) {
+            if (damageWatcher->start(nativeScreenRect)) {
+                pendingDamage = QRegion();
+                captureFullFrame();
+
+                qDebug() << "Screen capture started on screen changes, up to" << targetFps << "FPS";
+                return;
+            }
+
+            qDebug() << "Damage capture unavailable, falling back to timer capture";
+        }
+
+        if (!captureRegions.isEmpty()) {
+            // Every region and the rest of the screen keep their own deadline; the timer
+            // is re-armed for whichever comes first.
+            fullFrameDeadline = frameTimer.nsecsElapsed();
+            regionDeadlines.fill(fullFrameDeadline, captureRegions.size());
+            captureTimer->setSingleShot(true);
+            captureTimer->start(0);
+
+            qDebug() << "Screen capture started with" << captureRegions.size()
+                     << "regions, rest of the screen at" << targetFps << "FPS";
+            return;
+        }
+
+        int intervalMs = 1000 / targetFps;
+        captureTimer->setSingleShot(false);
+        captureTimer->start(intervalMs);
 
         qDebug() << "Screen capture started with" << targetFps << "FPS (interval:" << intervalMs << "ms)";
     }
@@ -75,17 +356,253 @@ void ScreenCapturer::startCapture()
 void ScreenCapturer::stopCapture()
 {
     captureTimer->stop();
+    damageTimer->stop();
+    damageWatcher->stop();
+    pendingDamage = QRegion();
     currentFps = 0;
     qDebug() << "Screen capture stopped";
 }
 
 void ScreenCapturer::onCaptureTimeout()
 {
-    QPixmap pixmap = captureScreen();
-    emit screenCaptured(pixmap);
+    if (captureRegions.isEmpty()) {
+        captureFullFrame();
+        return;
+    }
+
+    const qint64 now = frameTimer.nsecsElapsed();
+    const bool fullFrameDue = now >= fullFrameDeadline;
+    if (fullFrameDue) {
+        fullFrameDeadline = nextDeadline(fullFrameDeadline, 1000000000LL / targetFps, now);
+    }
+
+    // A full frame refreshes every region as well, so only regions due in between are grabbed alone.
+    QVector<int> dueRegions;
+    for (int i = 0; i < captureRegions.size(); ++i) {
+        if (fullFrameDue || now >= regionDeadlines[i]) {
+            regionDeadlines[i] = nextDeadline(regionDeadlines[i], 1000000000LL / captureRegions[i].fps, now);
+            if (!fullFrameDue) {
+                dueRegions.append(i);
+            }
+        }
+    }
+    scheduleNextCapture(now);
+
+    if (fullFrameDue) {
+        captureFullFrame();
+    } else if (!dueRegions.isEmpty()) {
+        captureRegionPatches(dueRegions);
+    }
+}
+
+void ScreenCapturer::scheduleNextCapture(qint64 nowNs)
+{
+    qint64 next = fullFrameDeadline;
+    for (qint64 deadline : regionDeadlines) {
+        next = qMin(next, deadline);
+    }
+
+    // Round up so the wake-up never lands before the deadline and has to be re-armed.
+    qint64 waitNs = qMax<qint64>(0, next - nowNs);
+    captureTimer->start(int((waitNs + 999999) / 1000000));
+}
+
+void ScreenCapturer::onScreenDamaged(const QRegion &region)
+{
+    pendingDamage += region;
+    if (damageTimer->isActive()) return;
+
+    qint64 wait = lastGrabTime + 1000 / targetFps - frameTimer.elapsed();
+    damageTimer->start(int(qMax<qint64>(0, wait)));
+}
+
+void ScreenCapturer::onDamageCaptureTimeout()
+{
+    captureDamagedRegion();
+}
+
+void ScreenCapturer::captureFullFrame()
+{
+    CapturedFrame frame;
+    frame.timestampNs = CapturedFrame::currentTimestampNs();
+    frame.image = captureScreen().toImage();
+    frame.sequence = ++frameSequence;
+    frame.screenGeometry = targetScreen ? targetScreen->geometry() : QRect();
+    frame.devicePixelRatio = targetScreen ? targetScreen->devicePixelRatio() : 1.0;
+    lastGrabTime = frameTimer.elapsed();
+    grabbedPixels += qint64(frame.image.width()) * frame.image.height();
+    regionImages.fill(QImage());
+
+    if (isChangeTrackingNeeded()) {
+        frame.dirtyRects = dirtyTracker.update(frame.image);
+        untrackedFrame = QImage();
+    } else {
+        dirtyTracker.reset();
+        frame.dirtyRects = QVector<QRect>() << frame.image.rect();
+        untrackedFrame = frame.image;
+    }
+
+    filters.process(frame);
+    deliverFrame(frame);
+}
+
+void ScreenCapturer::captureDamagedRegion()
+{
+    if (!targetScreen || pendingDamage.isEmpty()) return;
+
+    QRegion damage = pendingDamage;
+    pendingDamage = QRegion();
+
+    qreal dpr = targetScreen->devicePixelRatio();
+    QRect bounds = damage.boundingRect();
+    QRect logicalRect = QRectF(bounds.x() / dpr, bounds.y() / dpr,
+                               bounds.width() / dpr, bounds.height() / dpr)
+                            .toAlignedRect()
+                            .intersected(QRect(QPoint(0, 0), targetScreen->geometry().size()));
+    if (logicalRect.isEmpty()) return;
+
+    CapturedFrame frame;
+    frame.timestampNs = CapturedFrame::currentTimestampNs();
+    frame.image = targetScreen->grabWindow(0, logicalRect.x(), logicalRect.y(),
+                                           logicalRect.width(), logicalRect.height()).toImage();
+    frame.sequence = ++frameSequence;
+    frame.screenGeometry = targetScreen->geometry();
+    frame.devicePixelRatio = targetScreen->devicePixelRatio();
+    lastGrabTime = frameTimer.elapsed();
+    grabbedPixels += qint64(frame.image.width()) * frame.image.height();
+
+    QRect patchRect(QPoint(qRound(logicalRect.x() * dpr), qRound(logicalRect.y() * dpr)),
+                    frame.image.size());
+    for (const QRect &rect : damage) {
+        frame.dirtyRects.append(rect);
+    }
+
+    if (!filters.process(frame, patchRect)) {
+        captureFullFrame();
+        return;
+    }
+
+    deliverFrame(frame);
+}
+
+void ScreenCapturer::captureRegionPatches(const QVector<int> &regions)
+{
+    if (!targetScreen) return;
+
+    qreal dpr = targetScreen->devicePixelRatio();
+    QRect logicalScreen(QPoint(0, 0), targetScreen->geometry().size());
+
+    CapturedFrame frame;
+    frame.timestampNs = CapturedFrame::currentTimestampNs();
+    frame.screenGeometry = targetScreen->geometry();
+    frame.devicePixelRatio = targetScreen->devicePixelRatio();
+
+    QVector<FramePatch> patches;
+    for (int index : regions) {
+        const QRect &rect = captureRegions[index].rect;
+        QRect logicalRect = QRectF(rect.x() / dpr, rect.y() / dpr, rect.width() / dpr, rect.height() / dpr)
+                                .toAlignedRect()
+                                .intersected(logicalScreen);
+        if (logicalRect.isEmpty()) continue;
+
+        FramePatch patch;
+        patch.image = targetScreen->grabWindow(0, logicalRect.x(), logicalRect.y(),
+                                               logicalRect.width(), logicalRect.height()).toImage();
+        patch.origin = QPoint(qRound(logicalRect.x() * dpr), qRound(logicalRect.y() * dpr));
+        grabbedPixels += qint64(patch.image.width()) * patch.image.height();
+
+        // A region is grabbed on its deadline whether or not it moved; only changed rows go on.
+        QRect changed = changedRowSpan(regionImages[index], patch.image);
+        regionImages[index] = patch.image;
+        if (changed.isEmpty()) continue;
+
+        frame.dirtyRects.append(changed.translated(patch.origin));
+        patches.append(patch);
+    }
+    lastGrabTime = frameTimer.elapsed();
+    if (patches.isEmpty()) return;
+
+    frame.sequence = ++frameSequence;
+    if (!filters.process(frame, patches)) {
+        captureFullFrame();
+        return;
+    }
+
+    deliverFrame(frame);
+}
+
+void ScreenCapturer::deliverFrame(CapturedFrame &frame)
+{
+    pixelConverter.process(frame);
+
+    if (frameExporter) {
+        frameExporter->publish(frame);
+    }
+
+    emit frameCaptured(frame);
     updateFpsCounter();
 }
 
+void ScreenCapturer::logPixelModeStats()
+{
+    qint64 frames = pixelConverter.convertedFrames();
+    if (frames == 0) return;
+
+    double outputMb = pixelConverter.outputBytes() / 1e6 / frames;
+    double fullDepthMb = pixelConverter.fullDepthBytes() / 1e6 / frames;
+
+    // Frame sizes only; what the mode costs or saves overall is in the process CPU line.
+    qDebug() << "Pixel mode" << PixelModeConverter::modeName(pixelConverter.getMode()) << ":"
+             << "frame size" << outputMb << "MB (" << fullDepthMb << "MB at 32-bit),"
+             << "conversion" << pixelConverter.conversionNs() / 1000.0 / frames << "us/frame";
+    pixelConverter.resetStats();
+}
+
+int ScreenCapturer::fastestCaptureFps() const
+{
+    int fps = targetFps;
+    for (const CaptureRegion &region : captureRegions) {
+        fps = qMax(fps, region.fps);
+    }
+    return fps;
+}
+
+void ScreenCapturer::updateGrabStats()
+{
+    qint64 elapsed = grabStatsTimer.restart();
+    if (!targetScreen || elapsed <= 0) return;
+
+    // Compared against grabbing the whole screen at the fastest rate anything on it runs at.
+    QSize nativeSize = nativeScreenRect.size();
+    double fullScreenPixels = double(nativeSize.width()) * nativeSize.height() * fastestCaptureFps();
+    grabbedPixelsPerSecond = grabbedPixels * 1000.0 / elapsed;
+    grabAreaPercent = fullScreenPixels > 0 ? 100.0 * grabbedPixelsPerSecond / fullScreenPixels : 0.0;
+    grabbedPixels = 0;
+}
+
+void ScreenCapturer::logGrabStats()
+{
+    qDebug() << "Grabbed" << grabbedPixelsPerSecond / 1e6 << "Mpx/s,"
+             << grabAreaPercent << "% of full-screen capture at" << fastestCaptureFps() << "FPS";
+}
+
+void ScreenCapturer::logFilterStats()
+{
+    if (filters.isEmpty()) return;
+
+    for (const FrameFilterStats &stats : filters.stats()) {
+        if (stats.frames == 0) continue;
+
+        qDebug() << "Filter" << stats.name << "avg:" << (stats.totalNs / stats.frames) / 1000.0 << "us/frame,"
+                 << (stats.pixels ? double(stats.totalNs) / stats.pixels : 0.0) << "ns/pixel";
+    }
+    qDebug() << "Frames passed through unchanged:" << filters.unchangedFrames();
+    if (filters.sharedBufferCopies() > 0) {
+        qDebug() << "Pooled frames copied because a consumer still held them:" << filters.sharedBufferCopies();
+    }
+    filters.resetStats();
+}
+
 void ScreenCapturer::updateFpsCounter()
 {
     frameCount++;
@@ -94,6 +611,7 @@ void ScreenCapturer::updateFpsCounter()
 
     if (elapsed >= 1000) {
         currentFps = qRound((frameCount * 1000.0) / elapsed);
+        updateGrabStats();
         emit fpsUpdated(currentFps);
 
         frameCount = 0;
@@ -101,7 +619,15 @@ void ScreenCapturer::updateFpsCounter()
 
           static int debugCounter = 0;
         if (++debugCounter >= 5) {
-            qDebug() << "Capture FPS:" << currentFps << "/" << targetFps;
+            qint64 cpuNs = processCpuTimeNs();
+            qint64 wallMs = qMax<qint64>(1, currentTime - cpuLogStartMs);
+            qDebug() << "Capture FPS:" << currentFps << "/" << targetFps << "process CPU:"
+                     << (cpuNs - cpuLogStartNs) / 1e4 / wallMs << "% of one core";
+            cpuLogStartNs = cpuNs;
+            cpuLogStartMs = currentTime;
+            logGrabStats();
+            logPixelModeStats();
+            logFilterStats();
             debugCounter = 0;
         }
     }
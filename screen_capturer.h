@@ -8,11 +8,24 @@
 #include <QGuiApplication>
 #include <QElapsedTimer>
 
+#include "captured_frame.h"
+#include "capture_region.h"
+#include "dirty_tile_tracker.h"
+#include "frame_shm_writer.h"
+#include "frame_filter_pipeline.h"
+#include "x_damage_watcher.h"
+#include "pixel_mode_converter.h"
+
 class ScreenCapturer : public QObject
 {
     Q_OBJECT
 
 public:
+    enum CaptureMode {
+        TimerCapture,
+        DamageCapture
+    };
+
     explicit ScreenCapturer(QObject *parent = nullptr);
     ~ScreenCapturer();
 
@@ -22,27 +35,93 @@ public:
     void setTargetFps(int fps);
     int getCurrentFps() const;
 
+    void setCaptureRegions(const QVector<CaptureRegion> &regions);
+    QVector<CaptureRegion> getCaptureRegions() const;
+    double getGrabAreaPercent() const;
+    // Captured pixels per logical pixel of the target screen.
+    qreal getDevicePixelRatio() const;
+
+    void setCaptureMode(CaptureMode mode);
+    CaptureMode getCaptureMode() const;
+    bool isCapturing() const;
+    static bool isDamageCaptureSupported();
+
+    void setFrameExportEnabled(bool enabled);
+    bool isFrameExportEnabled() const;
+    QString frameExportKey() const;
+
+    FrameFilterPipeline *filterPipeline();
+
+    void setChangeTrackingRequired(bool required);
+    bool isChangeTrackingNeeded() const;
+    bool hasChangeBaseline() const;
+
+    void setPixelMode(PixelModeConverter::Mode mode);
+    PixelModeConverter::Mode getPixelMode() const;
+
 public slots:
     void startCapture();
     void stopCapture();
 
 signals:
-    void screenCaptured(const QPixmap &pixmap);
+    void frameCaptured(const CapturedFrame &frame);
     void fpsUpdated(int fps);
 
 private slots:
     void onCaptureTimeout();
+    void onScreenDamaged(const QRegion &region);
+    void onDamageCaptureTimeout();
+    void onScreenGeometryChanged();
 
 private:
     void updateFpsCounter();
+    void logFilterStats();
+    int fastestCaptureFps() const;
+    void updateGrabStats();
+    void logGrabStats();
+    void logPixelModeStats();
+
+    void captureFullFrame();
+    void captureDamagedRegion();
+    void captureRegionPatches(const QVector<int> &regions);
+    void scheduleNextCapture(qint64 nowNs);
+    void deliverFrame(CapturedFrame &frame);
+    void updateNativeScreenRect();
 
     QScreen *targetScreen;
+    QRect nativeScreenRect; // in root window pixels; looked up when capture starts or the screen moves
     QTimer *captureTimer;
     QElapsedTimer frameTimer;
     int targetFps;
     int currentFps;
     int frameCount;
     qint64 lastFpsUpdate;
+    qint64 cpuLogStartNs;
+    qint64 cpuLogStartMs;
+
+    FrameShmWriter *frameExporter;
+    DirtyTileTracker dirtyTracker;
+    QImage untrackedFrame;
+    FrameFilterPipeline filters;
+    PixelModeConverter pixelConverter;
+    bool changeTrackingRequired;
+    quint64 frameSequence;
+
+    CaptureMode captureMode;
+    XDamageWatcher *damageWatcher;
+    QTimer *damageTimer;
+    QRegion pendingDamage;
+    qint64 lastGrabTime;
+
+    QVector<CaptureRegion> captureRegions;
+    QVector<qint64> regionDeadlines;
+    QVector<QImage> regionImages;
+    qint64 fullFrameDeadline;
+
+    qint64 grabbedPixels;
+    QElapsedTimer grabStatsTimer;
+    double grabbedPixelsPerSecond;
+    double grabAreaPercent;
 };
 
 #endif
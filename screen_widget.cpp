@@ -7,29 +7,60 @@ ScreenWidget::ScreenWidget(QWidget *parent)
     : QWidget(parent),
     scaleFactor(1.0),
     imageOffset(0, 0),
+    imageOrigin(0, 0),
+    zoomFactor(1.0),
+    smoothScaling(true),
+    scaledCacheKey(0),
+    scaledCacheSmooth(true),
+    framePending(false),
+    droppedFrames(0),
+    presenter(new FramePresenter(this)),
+    regionEditMode(false),
     remoteCursorPos(0, 0),
     cursorUpdateTimer(new QTimer(this))
 {
     setMouseTracking(true);
+    setFocusPolicy(Qt::ClickFocus);
 
      cursorUpdateTimer->setInterval(50);
     connect(cursorUpdateTimer, &QTimer::timeout, this, &ScreenWidget::updateRemoteCursorPosition);
 }
 
-void ScreenWidget::setScreenImage(const QPixmap &pixmap)
+void ScreenWidget::setScreenImage(const QImage &image)
 {
-    screenPixmap = pixmap;
-    originalSize = pixmap.size();
+    if (!image.isNull() && image.cacheKey() == screenImage.cacheKey()) return;
 
-     if (!pixmap.isNull() && remoteCursorPos.isNull()) {
-        remoteCursorPos = QPoint(pixmap.width() / 2, pixmap.height() / 2);
+    if (framePending) {
+        droppedFrames++;
+    }
+    framePending = !image.isNull();
+
+    screenImage = image;
+    originalSize = image.size();
+
+     if (!image.isNull() && remoteCursorPos.isNull()) {
+        remoteCursorPos = QPoint(image.width() / 2, image.height() / 2);
         cursorUpdateTimer->start();
-    } else if (pixmap.isNull()) {
+    } else if (image.isNull()) {
         cursorUpdateTimer->stop();
     }
 
     updateScaleAndOffset();
-    update();
+    presenter->requestPresent(FramePresenter::FrameChange);
+}
+
+void ScreenWidget::setScreenFrame(const CapturedFrame &frame)
+{
+    if (!frame.image.isNull() && frame.image.cacheKey() == screenImage.cacheKey()) return;
+
+    presenter->noteFrameReady(frame.sequence, frame.timestampNs);
+    imageOrigin = frame.origin;
+    setScreenImage(frame.image);
+}
+
+PresentStats ScreenWidget::getPresentStats() const
+{
+    return presenter->stats();
 }
 
 void ScreenWidget::updateRemoteCursorPosition()
@@ -41,9 +72,11 @@ void ScreenWidget::updateRemoteCursorPosition()
 
       QRect screenGeometry = currentScreen->geometry();
     if (screenGeometry.contains(globalPos)) {
-         remoteCursorPos = QPoint(globalPos.x() - screenGeometry.x(),
-                                 globalPos.y() - screenGeometry.y());
-        update();
+        QPoint cursorPos(globalPos.x() - screenGeometry.x(), globalPos.y() - screenGeometry.y());
+        if (cursorPos == remoteCursorPos) return;
+
+        remoteCursorPos = cursorPos;
+        presenter->requestPresent(FramePresenter::CursorChange);
     }
 }
 
@@ -57,19 +90,114 @@ QPoint ScreenWidget::getImageOffset() const
     return imageOffset;
 }
 
+void ScreenWidget::setZoomFactor(qreal zoom)
+{
+    zoomFactor = qBound(1.0, zoom, 8.0);
+    if (!screenImage.isNull() && zoomCenter.isNull()) {
+        zoomCenter = QPointF(screenImage.width() / 2.0, screenImage.height() / 2.0);
+    }
+    updateScaleAndOffset();
+    presenter->requestPresent(FramePresenter::OverlayChange);
+}
+
+qreal ScreenWidget::getZoomFactor() const
+{
+    return zoomFactor;
+}
+
+void ScreenWidget::setSmoothScaling(bool smooth)
+{
+    smoothScaling = smooth;
+    presenter->requestPresent(FramePresenter::OverlayChange);
+}
+
+bool ScreenWidget::isSmoothScaling() const
+{
+    return smoothScaling;
+}
+
+quint64 ScreenWidget::getDroppedFrames() const
+{
+    return droppedFrames;
+}
+
+void ScreenWidget::setRegionEditMode(bool enabled)
+{
+    regionEditMode = enabled;
+    regionDragRect = QRect();
+    setCursor(enabled ? Qt::CrossCursor : Qt::ArrowCursor);
+    presenter->requestPresent(FramePresenter::OverlayChange);
+}
+
+bool ScreenWidget::isRegionEditMode() const
+{
+    return regionEditMode;
+}
+
+void ScreenWidget::setCaptureRegions(const QVector<CaptureRegion> &regions)
+{
+    captureRegions = regions;
+    presenter->requestPresent(FramePresenter::OverlayChange);
+}
+
 void ScreenWidget::updateScaleAndOffset()
 {
-    if (screenPixmap.isNull()) return;
+    if (screenImage.isNull()) return;
+
+    qreal scaleX = qreal(width()) / qreal(screenImage.width());
+    qreal scaleY = qreal(height()) / qreal(screenImage.height());
+    scaleFactor = qMin(scaleX, scaleY) * zoomFactor;
+
+    int scaledWidth = screenImage.width() * scaleFactor;
+    int scaledHeight = screenImage.height() * scaleFactor;
+
+    if (zoomFactor <= 1.0) {
+        imageOffset.setX((width() - scaledWidth) / 2);
+        imageOffset.setY((height() - scaledHeight) / 2);
+        return;
+    }
+
+    int offsetX = qRound(width() / 2.0 - zoomCenter.x() * scaleFactor);
+    int offsetY = qRound(height() / 2.0 - zoomCenter.y() * scaleFactor);
+
+    imageOffset.setX(scaledWidth < width() ? (width() - scaledWidth) / 2
+                                           : qBound(width() - scaledWidth, offsetX, 0));
+    imageOffset.setY(scaledHeight < height() ? (height() - scaledHeight) / 2
+                                             : qBound(height() - scaledHeight, offsetY, 0));
+}
+
+QImage ScreenWidget::scaledVisibleImage(QRect *targetRect)
+{
+    QRect imageRect(imageOffset, screenImage.size() * scaleFactor);
+    QRect visibleRect = imageRect.intersected(rect());
+
+    QRect sourceRect = QRectF(QPointF(visibleRect.topLeft() - imageOffset) / scaleFactor,
+                              QSizeF(visibleRect.size()) / scaleFactor)
+                           .toAlignedRect()
+                           .intersected(screenImage.rect());
 
-    qreal scaleX = qreal(width()) / qreal(screenPixmap.width());
-    qreal scaleY = qreal(height()) / qreal(screenPixmap.height());
-    scaleFactor = qMin(scaleX, scaleY);
+    *targetRect = QRectF(QPointF(imageOffset) + QPointF(sourceRect.topLeft()) * scaleFactor,
+                         QSizeF(sourceRect.size()) * scaleFactor).toRect();
 
-    int scaledWidth = screenPixmap.width() * scaleFactor;
-    int scaledHeight = screenPixmap.height() * scaleFactor;
+    if (scaledCacheKey == screenImage.cacheKey() && scaledCacheSource == sourceRect
+        && scaledCacheSize == targetRect->size() && scaledCacheSmooth == smoothScaling) {
+        return scaledCache;
+    }
 
-    imageOffset.setX((width() - scaledWidth) / 2);
-    imageOffset.setY((height() - scaledHeight) / 2);
+    // Smooth scaling always works in 32-bit, so reduced pixel modes are scaled in their own format.
+    Qt::TransformationMode mode = smoothScaling && screenImage.depth() == 32 ? Qt::SmoothTransformation
+                                                                             : Qt::FastTransformation;
+    if (sourceRect == screenImage.rect()) {
+        scaledCache = screenImage.scaled(targetRect->size(), Qt::IgnoreAspectRatio, mode);
+    } else {
+        scaledCache = screenImage.copy(sourceRect).scaled(targetRect->size(), Qt::IgnoreAspectRatio, mode);
+    }
+
+    scaledCacheKey = screenImage.cacheKey();
+    scaledCacheSource = sourceRect;
+    scaledCacheSize = targetRect->size();
+    scaledCacheSmooth = smoothScaling;
+    return scaledCache;
 }
 
 void ScreenWidget::drawRemoteCursor(QPainter &painter, const QPoint &position)
@@ -87,6 +215,24 @@ void ScreenWidget::drawRemoteCursor(QPainter &painter, const QPoint &position)
     painter.drawEllipse(position, size/2, size/2);
 }
 
+void ScreenWidget::drawCaptureRegions(QPainter &painter)
+{
+    painter.setBrush(Qt::NoBrush);
+    painter.setFont(QFont("Arial", 9));
+
+    for (const CaptureRegion &region : captureRegions) {
+        QRect widgetRect = convertScreenToWidgetRect(region.rect);
+        painter.setPen(QPen(QColor(255, 170, 0), 2));
+        painter.drawRect(widgetRect);
+        painter.drawText(widgetRect.topLeft() + QPoint(4, 14), QString("%1 FPS").arg(region.fps));
+    }
+
+    if (!regionDragRect.isNull()) {
+        painter.setPen(QPen(QColor(255, 170, 0), 1, Qt::DashLine));
+        painter.drawRect(convertScreenToWidgetRect(regionDragRect));
+    }
+}
+
 void ScreenWidget::paintEvent(QPaintEvent *event)
 {
     Q_UNUSED(event);
@@ -95,25 +241,37 @@ void ScreenWidget::paintEvent(QPaintEvent *event)
     painter.setRenderHint(QPainter::Antialiasing, true);
     painter.fillRect(rect(), QColor(45, 45, 48));
 
-    if (!screenPixmap.isNull()) {
-        QPixmap scaledPixmap = screenPixmap.scaled(
-            screenPixmap.size() * scaleFactor,
-            Qt::KeepAspectRatio,
-            Qt::SmoothTransformation
-            );
-
-        painter.drawPixmap(imageOffset, scaledPixmap);
+    if (!screenImage.isNull()) {
+        QRect targetRect;
+        QImage scaledImage = scaledVisibleImage(&targetRect);
+        painter.drawImage(targetRect.topLeft(), scaledImage);
+        framePending = false;
 
         QPoint widgetCursorPos = convertScreenToWidgetPos(remoteCursorPos);
         if (rect().contains(widgetCursorPos)) {
             drawRemoteCursor(painter, widgetCursorPos);
         }
 
+        drawCaptureRegions(painter);
+
         painter.setPen(Qt::white);
         painter.setFont(QFont("Arial", 10));
-        painter.drawText(10, 25, QString("Scale: %1").arg(scaleFactor, 0, 'f', 2));
+        painter.drawText(10, 25, QString("Scale: %1  Zoom: %2x%3")
+                                     .arg(scaleFactor, 0, 'f', 2)
+                                     .arg(zoomFactor, 0, 'f', 2)
+                                     .arg(smoothScaling && screenImage.depth() == 32 ? "" : "  (fast scaling)"));
         painter.drawText(10, 45, QString("Remote cursor: %1, %2").arg(remoteCursorPos.x()).arg(remoteCursorPos.y()));
         painter.drawText(10, 65, "Click to move cursor to this position");
+        painter.drawText(10, 85, QString("Dropped frames: %1").arg(droppedFrames));
+
+        PresentStats stats = presenter->stats();
+        painter.drawText(10, 105, QString("Present: %1 FPS @ %2 Hz, latency %3 ms, judder %4 ms, missed %5, skipped %6")
+                                      .arg(stats.presentFps, 0, 'f', 1)
+                                      .arg(stats.refreshRate, 0, 'f', 0)
+                                      .arg(stats.avgLatencyMs, 0, 'f', 1)
+                                      .arg(stats.judderMs, 0, 'f', 2)
+                                      .arg(stats.missedRefreshes)
+                                      .arg(stats.skippedFrames));
     } else {
         painter.fillRect(rect(), QColor(60, 60, 60));
         painter.setPen(QColor(200, 200, 200));
@@ -124,36 +282,51 @@ void ScreenWidget::paintEvent(QPaintEvent *event)
 
 QPoint ScreenWidget::convertWidgetToScreenPos(const QPoint &widgetPos) const
 {
-    if (screenPixmap.isNull()) return QPoint();
+    if (screenImage.isNull()) return QPoint();
 
     int screenX = (widgetPos.x() - imageOffset.x()) / scaleFactor;
     int screenY = (widgetPos.y() - imageOffset.y()) / scaleFactor;
 
-    screenX = qBound(0, screenX, screenPixmap.width() - 1);
-    screenY = qBound(0, screenY, screenPixmap.height() - 1);
+    screenX = qBound(0, screenX, screenImage.width() - 1);
+    screenY = qBound(0, screenY, screenImage.height() - 1);
 
-    return QPoint(screenX, screenY);
+    return QPoint(screenX, screenY) + imageOrigin;
 }
 
 QPoint ScreenWidget::convertScreenToWidgetPos(const QPoint &screenPos) const
 {
-    if (screenPixmap.isNull()) return QPoint();
+    if (screenImage.isNull()) return QPoint();
 
-    int widgetX = imageOffset.x() + screenPos.x() * scaleFactor;
-    int widgetY = imageOffset.y() + screenPos.y() * scaleFactor;
+    int widgetX = imageOffset.x() + (screenPos.x() - imageOrigin.x()) * scaleFactor;
+    int widgetY = imageOffset.y() + (screenPos.y() - imageOrigin.y()) * scaleFactor;
 
     return QPoint(widgetX, widgetY);
 }
 
+QRect ScreenWidget::convertScreenToWidgetRect(const QRect &screenRect) const
+{
+    return QRect(convertScreenToWidgetPos(screenRect.topLeft()),
+                 QSize(qRound(screenRect.width() * scaleFactor), qRound(screenRect.height() * scaleFactor)));
+}
+
 void ScreenWidget::mousePressEvent(QMouseEvent *event)
 {
-    if (screenPixmap.isNull()) {
+    if (screenImage.isNull()) {
         event->ignore();
         return;
     }
 
     QPoint screenPos = convertWidgetToScreenPos(event->pos());
 
+    // While editing regions a left drag draws a region instead of clicking on the remote screen.
+    if (regionEditMode && event->button() == Qt::LeftButton) {
+        regionDragStart = screenPos;
+        regionDragRect = QRect(screenPos, QSize(1, 1));
+        presenter->requestPresent(FramePresenter::OverlayChange);
+        event->accept();
+        return;
+    }
+
      emit mouseMoved(screenPos);
 
     emit mousePressed(screenPos, event->button());
@@ -163,12 +336,24 @@ void ScreenWidget::mousePressEvent(QMouseEvent *event)
 
 void ScreenWidget::mouseReleaseEvent(QMouseEvent *event)
 {
-    if (screenPixmap.isNull()) {
+    if (screenImage.isNull()) {
         event->ignore();
         return;
     }
 
     QPoint screenPos = convertWidgetToScreenPos(event->pos());
+
+    if (regionEditMode && event->button() == Qt::LeftButton) {
+        QRect drawn = QRect(regionDragStart, screenPos).normalized();
+        regionDragRect = QRect();
+        presenter->requestPresent(FramePresenter::OverlayChange);
+        if (drawn.width() >= 8 && drawn.height() >= 8) {
+            emit regionDrawn(drawn);
+        }
+        event->accept();
+        return;
+    }
+
     emit mouseReleased(screenPos, event->button());
 
     event->accept();
@@ -176,19 +361,38 @@ void ScreenWidget::mouseReleaseEvent(QMouseEvent *event)
 
 void ScreenWidget::mouseMoveEvent(QMouseEvent *event)
 {
-    update();
+    if (!regionDragRect.isNull() && (event->buttons() & Qt::LeftButton)) {
+        regionDragRect = QRect(regionDragStart, convertWidgetToScreenPos(event->pos())).normalized();
+    }
+    presenter->requestPresent(FramePresenter::OverlayChange);
     event->accept();
 }
 
 void ScreenWidget::wheelEvent(QWheelEvent *event)
 {
-    if (screenPixmap.isNull()) {
+    if (screenImage.isNull()) {
         event->ignore();
         return;
     }
 
-    QPoint screenPos = convertWidgetToScreenPos(event->position().toPoint());
+    QPoint widgetPos = event->position().toPoint();
     int delta = event->angleDelta().y();
+
+    if (event->modifiers() & Qt::ControlModifier) {
+        QPointF anchor = QPointF(widgetPos - imageOffset) / scaleFactor;
+
+        zoomFactor = qBound(1.0, zoomFactor * (delta > 0 ? 1.25 : 0.8), 8.0);
+        updateScaleAndOffset();
+
+        zoomCenter = anchor - QPointF(widgetPos - rect().center()) / scaleFactor;
+        updateScaleAndOffset();
+        presenter->requestPresent(FramePresenter::OverlayChange);
+
+        event->accept();
+        return;
+    }
+
+    QPoint screenPos = convertWidgetToScreenPos(widgetPos);
     emit mouseWheel(screenPos, delta);
 
     event->accept();
@@ -199,3 +403,21 @@ void ScreenWidget::resizeEvent(QResizeEvent *event)
     Q_UNUSED(event);
     updateScaleAndOffset();
 }
+
+void ScreenWidget::keyPressEvent(QKeyEvent *event)
+{
+    if (event->modifiers() & Qt::ControlModifier) {
+        if (event->key() == Qt::Key_0) {
+            setZoomFactor(1.0);
+            event->accept();
+            return;
+        }
+        if (event->key() == Qt::Key_F) {
+            setSmoothScaling(!smoothScaling);
+            event->accept();
+            return;
+        }
+    }
+
+    QWidget::keyPressEvent(event);
+}
@@ -2,12 +2,17 @@
 #define SCREEN_WIDGET_H
 
 #include <QWidget>
-#include <QPixmap>
+#include <QImage>
 #include <QPainter>
 #include <QMouseEvent>
 #include <QWheelEvent>
+#include <QKeyEvent>
 #include <QTimer>
 
+#include "captured_frame.h"
+#include "capture_region.h"
+#include "frame_presenter.h"
+
 class ScreenWidget : public QWidget
 {
     Q_OBJECT
@@ -15,10 +20,22 @@ class ScreenWidget : public QWidget
 public:
     explicit ScreenWidget(QWidget *parent = nullptr);
 
-    void setScreenImage(const QPixmap &pixmap);
+    void setScreenImage(const QImage &image);
+    void setScreenFrame(const CapturedFrame &frame);
     qreal getScaleFactor() const;
     QPoint getImageOffset() const;
-    bool isCaptureActive() const { return !screenPixmap.isNull(); }
+    bool isCaptureActive() const { return !screenImage.isNull(); }
+
+    void setZoomFactor(qreal zoom);
+    qreal getZoomFactor() const;
+    void setSmoothScaling(bool smooth);
+    bool isSmoothScaling() const;
+    quint64 getDroppedFrames() const;
+    PresentStats getPresentStats() const;
+
+    void setRegionEditMode(bool enabled);
+    bool isRegionEditMode() const;
+    void setCaptureRegions(const QVector<CaptureRegion> &regions);
 
     void updateRemoteCursorPosition();
 
@@ -28,6 +45,7 @@ signals:
     void mousePressed(const QPoint &position, Qt::MouseButton button);
     void mouseReleased(const QPoint &position, Qt::MouseButton button);
     void mouseWheel(const QPoint &position, int delta);
+    void regionDrawn(const QRect &rect);
 
 protected:
     void paintEvent(QPaintEvent *event) override;
@@ -36,17 +54,40 @@ protected:
     void mouseMoveEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent *event) override;
     void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
 
 private:
     void drawRemoteCursor(QPainter &painter, const QPoint &position);
+    void drawCaptureRegions(QPainter &painter);
     QPoint convertWidgetToScreenPos(const QPoint &widgetPos) const;
     QPoint convertScreenToWidgetPos(const QPoint &screenPos) const;
+    QRect convertScreenToWidgetRect(const QRect &screenRect) const;
     void updateScaleAndOffset();
+    QImage scaledVisibleImage(QRect *targetRect);
 
-    QPixmap screenPixmap;
+    QImage screenImage;
     qreal scaleFactor;
     QSize originalSize;
     QPoint imageOffset;
+    QPoint imageOrigin; // screen position of the image's top-left, set by a crop
+    qreal zoomFactor;
+    QPointF zoomCenter;
+    bool smoothScaling;
+
+    QImage scaledCache;
+    qint64 scaledCacheKey;
+    QRect scaledCacheSource;
+    QSize scaledCacheSize;
+    bool scaledCacheSmooth;
+
+    bool framePending;
+    quint64 droppedFrames;
+    FramePresenter *presenter;
+
+    bool regionEditMode;
+    QPoint regionDragStart;
+    QRect regionDragRect;
+    QVector<CaptureRegion> captureRegions;
 
     QPoint remoteCursorPos;
     QTimer* cursorUpdateTimer;
@@ -0,0 +1,9 @@
+#ifndef SIMD_SUPPORT_H
+#define SIMD_SUPPORT_H
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MDH_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#endif
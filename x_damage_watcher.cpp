@@ -0,0 +1,189 @@
+#include "x_damage_watcher.h"
+#include <QDebug>
+#include <QGuiApplication>
+
+#ifdef MDH_HAVE_XDAMAGE
+#include <X11/Xlib.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xfixes.h>
+#ifdef MDH_HAVE_XRANDR
+#include <X11/extensions/Xrandr.h>
+#endif
+#endif
+
+XDamageWatcher::XDamageWatcher(QObject *parent)
+    : QObject(parent),
+    display(nullptr),
+    damage(0),
+    damageEventBase(0),
+    notifier(nullptr)
+{
+}
+
+XDamageWatcher::~XDamageWatcher()
+{
+    stop();
+}
+
+bool XDamageWatcher::isSupported()
+{
+#ifdef MDH_HAVE_XDAMAGE
+    return QGuiApplication::platformName() == QLatin1String("xcb");
+#else
+    return false;
+#endif
+}
+
+QRect XDamageWatcher::outputGeometry(const QString &outputName)
+{
+    QRect geometry;
+#if defined(MDH_HAVE_XDAMAGE) && defined(MDH_HAVE_XRANDR)
+    if (!isSupported()) return geometry;
+
+    Display *x11 = XOpenDisplay(nullptr);
+    if (!x11) return geometry;
+
+    XRRScreenResources *resources = XRRGetScreenResourcesCurrent(x11, DefaultRootWindow(x11));
+    for (int i = 0; resources && i < resources->noutput && geometry.isNull(); ++i) {
+        XRROutputInfo *output = XRRGetOutputInfo(x11, resources, resources->outputs[i]);
+        if (!output) continue;
+
+        if (output->crtc && QString::fromLocal8Bit(output->name, output->nameLen) == outputName) {
+            XRRCrtcInfo *crtc = XRRGetCrtcInfo(x11, resources, output->crtc);
+            if (crtc) {
+                geometry = QRect(crtc->x, crtc->y, int(crtc->width), int(crtc->height));
+                XRRFreeCrtcInfo(crtc);
+            }
+        }
+        XRRFreeOutputInfo(output);
+    }
+
+    if (resources) {
+        XRRFreeScreenResources(resources);
+    }
+    XCloseDisplay(x11);
+#else
+    Q_UNUSED(outputName);
+#endif
+    return geometry;
+}
+
+bool XDamageWatcher::isActive() const
+{
+    return display != nullptr;
+}
+
+bool XDamageWatcher::start(const QRect &nativeScreenRect)
+{
+    stop();
+
+#ifdef MDH_HAVE_XDAMAGE
+    if (!isSupported()) {
+        qDebug() << "X Damage capture needs the xcb platform, running on" << QGuiApplication::platformName();
+        return false;
+    }
+
+    Display *x11 = XOpenDisplay(nullptr);
+    if (!x11) {
+        qDebug() << "X Damage capture: cannot open X display";
+        return false;
+    }
+
+    int errorBase = 0;
+    if (!XDamageQueryExtension(x11, &damageEventBase, &errorBase)) {
+        qDebug() << "X Damage capture: DAMAGE extension not available";
+        XCloseDisplay(x11);
+        return false;
+    }
+
+    int fixesEventBase = 0;
+    if (!XFixesQueryExtension(x11, &fixesEventBase, &errorBase)) {
+        qDebug() << "X Damage capture: XFIXES extension not available";
+        XCloseDisplay(x11);
+        return false;
+    }
+
+    damage = XDamageCreate(x11, DefaultRootWindow(x11), XDamageReportNonEmpty);
+    XFlush(x11);
+
+    display = x11;
+    watchedRect = nativeScreenRect;
+
+    notifier = new QSocketNotifier(ConnectionNumber(x11), QSocketNotifier::Read, this);
+    connect(notifier, &QSocketNotifier::activated, this, &XDamageWatcher::onEventsReady);
+
+    qDebug() << "X Damage capture watching" << watchedRect;
+    return true;
+#else
+    Q_UNUSED(nativeScreenRect);
+    qDebug() << "X Damage capture is not available in this build";
+    return false;
+#endif
+}
+
+void XDamageWatcher::stop()
+{
+    delete notifier;
+    notifier = nullptr;
+
+#ifdef MDH_HAVE_XDAMAGE
+    if (display) {
+        Display *x11 = static_cast<Display *>(display);
+        if (damage) {
+            XDamageDestroy(x11, damage);
+        }
+        XCloseDisplay(x11);
+    }
+#endif
+
+    display = nullptr;
+    damage = 0;
+}
+
+void XDamageWatcher::onEventsReady()
+{
+#ifdef MDH_HAVE_XDAMAGE
+    if (!display) return;
+
+    Display *x11 = static_cast<Display *>(display);
+    QRegion region;
+    bool damageNotified = false;
+
+    while (XPending(x11) > 0) {
+        XEvent event;
+        XNextEvent(x11, &event);
+        if (event.type == damageEventBase + XDamageNotify) {
+            damageNotified = true;
+        }
+    }
+
+    if (!damageNotified) return;
+
+    XserverRegion parts = XFixesCreateRegion(x11, nullptr, 0);
+    XDamageSubtract(x11, damage, None, parts);
+
+    int count = 0;
+    XRectangle *rects = XFixesFetchRegion(x11, parts, &count);
+    for (int i = 0; i < count; ++i) {
+        QRect rect(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+        rect = rect.intersected(watchedRect);
+        if (!rect.isEmpty()) {
+            region += rect.translated(-watchedRect.topLeft());
+        }
+    }
+
+    if (rects) {
+        XFree(rects);
+    }
+    XFixesDestroyRegion(x11, parts);
+    XFlush(x11);
+
+    if (XPending(x11) > 0) {
+        QMetaObject::invokeMethod(this, &XDamageWatcher::onEventsReady, Qt::QueuedConnection);
+    }
+
+    if (!region.isEmpty()) {
+        emit damaged(region);
+    }
+#endif
+}
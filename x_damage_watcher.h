@@ -0,0 +1,39 @@
+#ifndef X_DAMAGE_WATCHER_H
+#define X_DAMAGE_WATCHER_H
+
+#include <QObject>
+#include <QRect>
+#include <QRegion>
+#include <QSocketNotifier>
+
+class XDamageWatcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit XDamageWatcher(QObject *parent = nullptr);
+    ~XDamageWatcher();
+
+    static bool isSupported();
+    // Geometry of the XRandR output in root window pixels, or a null rect if it is unknown.
+    static QRect outputGeometry(const QString &outputName);
+
+    bool start(const QRect &nativeScreenRect);
+    void stop();
+    bool isActive() const;
+
+signals:
+    void damaged(const QRegion &region);
+
+private slots:
+    void onEventsReady();
+
+private:
+    void *display;
+    unsigned long damage;
+    int damageEventBase;
+    QRect watchedRect;
+    QSocketNotifier *notifier;
+};
+
+#endif